@@ -0,0 +1,124 @@
+#include <libtlv/tlv.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+/*
+ * Encoder benchmark: dump() with cached sizes, dump() after a leaf changed, and the
+ * single pass dump_reverse(), on a deep and on a wide tree. Also detaching children
+ * from the middle of a wide node.
+ */
+
+namespace
+{
+    // chain of constructed nodes, each with one primitive sibling of the next level
+    Tlv build_deep( int depth, Tlv& leaf )
+    {
+        leaf = Tlv( 0x9F02, std::string( 6, '\x01' ) );
+        Tlv node( 0x70, leaf );
+        for( int i = 1; i < depth; i++ )
+        {
+            Tlv parent( 0x70 );
+            parent.push_back( Tlv( 0x5A, std::string( 8, '\x02' ) ) );
+            parent.push_back( node );
+            node = parent;
+        }
+        return node;
+    }
+
+    // one constructed root with many records of two primitive nodes
+    Tlv build_wide( int width, Tlv& leaf )
+    {
+        Tlv root( 0xE1 );
+        for( int i = 0; i < width; i++ )
+        {
+            Tlv record( 0x70 );
+            record.push_back( Tlv( 0x9F02, std::string( 6, '\x01' ) ) );
+            record.push_back( Tlv( 0x5A, std::string( 8, '\x02' ) ) );
+            root.push_back( record );
+        }
+        leaf = root.back().front();
+        return root;
+    }
+
+    template< typename F >
+    double measure( int iterations, F f )
+    {
+        size_t bytes = 0;
+        auto begin = std::chrono::steady_clock::now();
+        for( int i = 0; i < iterations; i++ )
+        {
+            bytes += f();
+        }
+        auto end = std::chrono::steady_clock::now();
+        if( bytes == 0 )
+        {
+            std::printf( "no output\n" );
+        }
+        return std::chrono::duration<double, std::micro>( end - begin ).count() / iterations;
+    }
+
+    void run( const char* name, Tlv tree, Tlv leaf, int iterations )
+    {
+        if( tree.dump() != tree.dump_reverse() )
+        {
+            std::printf( "%s: dump_reverse output differs\n", name );
+            std::exit( 1 );
+        }
+
+        double cached = measure( iterations, [&]() { return tree.dump().size(); } );
+        double changed = measure( iterations, [&]()
+        {
+            leaf.value()[0]++;
+            return tree.dump().size();
+        } );
+        double reverse = measure( iterations, [&]() { return tree.dump_reverse().size(); } );
+
+        std::printf( "%-6s %10zu bytes  dump (cached) %10.1f us  dump (leaf changed) %10.1f us  dump_reverse %10.1f us\n",
+                     name, tree.encoded_size(), cached, changed, reverse );
+    }
+
+    // detach the middle half of the children of a wide node, each at the same index
+    void run_detach( int width, int iterations )
+    {
+        double total = 0;
+        for( int n = 0; n < iterations; n++ )
+        {
+            Tlv root( 0xE1 );
+            std::vector<Tlv> children;
+            for( int i = 0; i < width; i++ )
+            {
+                children.push_back( Tlv( 0x5A, std::string( 8, '\x02' ) ) );
+                root.push_back( children.back() );
+            }
+            int i = width / 4;
+            total += measure( width / 2, [&]()
+            {
+                children[i++].detach();
+                return root.num_children();
+            } );
+        }
+        std::printf( "%-6s %10d nodes  detach (middle) %10.3f us\n", "detach", width, total / iterations );
+    }
+}
+
+int main( int argc, char** argv )
+{
+    int iterations = argc > 1 ? std::atoi( argv[1] ) : 100;
+    if( iterations <= 0 )
+    {
+        std::printf( "usage: %s [iterations]\n", argv[0] );
+        return 1;
+    }
+
+    Tlv leaf;
+    Tlv deep = build_deep( 2000, leaf );
+    run( "deep", deep, leaf, iterations );
+
+    Tlv wide = build_wide( 100000, leaf );
+    run( "wide", wide, leaf, iterations );
+
+    run_detach( 10000, iterations );
+    return 0;
+}
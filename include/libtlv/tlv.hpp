@@ -1,20 +1,432 @@
 #pragma once
 #include <cstdint>
+#include <cstdio>
 #include <string>
 #include <string_view>
 #include <vector>
 #include <list>
 #include <memory>
+#include <new>
+#include <memory_resource>
 #include <functional>
 #include <limits>
 #include <iterator>
+#include <algorithm>
+#include <initializer_list>
+#include <stdexcept>
+#include <type_traits>
 
 namespace LibtlvUtil
 {
     std::vector<uint8_t> unhexify( std::string_view hexInput, bool throw_ex = false );
     std::string hexify( const std::vector<uint8_t> &data, bool lower_case = false );
+    std::string hexify( const uint8_t *data, size_t size, bool lower_case = false );
+
+    /**
+     * Vector with inline storage for up to N elements, larger sizes allocate from a memory resource.
+     * The interface is the subset of std::pmr::vector used by the library. Moving a vector whose
+     * elements are stored inline moves the elements, so iterators into it are invalidated.
+     * Insertion and removal at the front are amortized O(1), free space is kept in front of the elements.
+     */
+    template< typename T, size_t N >
+    class SmallVector
+    {
+        static_assert( N > 0, "Inline capacity must not be zero" );
+
+    public:
+        typedef T value_type;
+        typedef size_t size_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef T& reference;
+        typedef const T& const_reference;
+        typedef T* pointer;
+        typedef const T* const_pointer;
+        typedef T* iterator;
+        typedef const T* const_iterator;
+        typedef std::reverse_iterator<iterator> reverse_iterator;
+        typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+        typedef std::pmr::polymorphic_allocator<T> allocator_type;
+        static constexpr size_t inline_capacity = N;
+
+        SmallVector() : SmallVector( std::pmr::get_default_resource() ) {}
+        explicit SmallVector( std::pmr::memory_resource* resource ) :
+            _data( _inline() ), _size( 0 ), _capacity( N ), _front( 0 ), _resource( resource ) {}
+        SmallVector( const allocator_type& allocator ) : SmallVector( allocator.resource() ) {}
+
+        template< typename It, typename = typename std::iterator_traits<It>::iterator_category >
+        SmallVector( It first, It last, const allocator_type& allocator = allocator_type() ) :
+            SmallVector( allocator.resource() )
+        {
+            assign( first, last );
+        }
+
+        SmallVector( std::initializer_list<T> init, const allocator_type& allocator = allocator_type() ) :
+            SmallVector( allocator.resource() )
+        {
+            assign( init.begin(), init.end() );
+        }
+
+        // copies use the default resource, like std::pmr::vector
+        SmallVector( const SmallVector& other ) :
+            SmallVector()
+        {
+            assign( other.begin(), other.end() );
+        }
+
+        SmallVector( SmallVector&& other ) noexcept :
+            SmallVector( other._resource )
+        {
+            _steal( other );
+        }
+
+        ~SmallVector()
+        {
+            clear();
+            _deallocate();
+        }
+
+        SmallVector& operator=( const SmallVector& other )
+        {
+            if( this != &other )
+            {
+                assign( other.begin(), other.end() );
+            }
+            return *this;
+        }
+
+        // storage is taken over if both use the same resource, otherwise elements are moved
+        SmallVector& operator=( SmallVector&& other )
+        {
+            if( this == &other )
+            {
+                return *this;
+            }
+            if( _resource == other._resource )
+            {
+                clear();
+                _deallocate();
+                _steal( other );
+            }
+            else
+            {
+                assign( std::make_move_iterator( other.begin() ), std::make_move_iterator( other.end() ) );
+                other.clear();
+            }
+            return *this;
+        }
+
+        allocator_type get_allocator() const { return allocator_type( _resource ); }
+
+        size_type size() const { return _size; }
+        size_type capacity() const { return _capacity; }
+        bool empty() const { return _size == 0; }
+        // true while elements are stored inside the vector
+        bool is_inline() const { return _data - _front == _inline(); }
+
+        T* data() { return _data; }
+        const T* data() const { return _data; }
+        iterator begin() { return _data; }
+        iterator end() { return _data + _size; }
+        const_iterator begin() const { return _data; }
+        const_iterator end() const { return _data + _size; }
+        const_iterator cbegin() const { return _data; }
+        const_iterator cend() const { return _data + _size; }
+        reverse_iterator rbegin() { return reverse_iterator( end() ); }
+        reverse_iterator rend() { return reverse_iterator( begin() ); }
+        const_reverse_iterator rbegin() const { return const_reverse_iterator( end() ); }
+        const_reverse_iterator rend() const { return const_reverse_iterator( begin() ); }
+
+        T& operator[]( size_type i ) { return _data[i]; }
+        const T& operator[]( size_type i ) const { return _data[i]; }
+        T& front() { return _data[0]; }
+        const T& front() const { return _data[0]; }
+        T& back() { return _data[_size - 1]; }
+        const T& back() const { return _data[_size - 1]; }
+
+        T& at( size_type i )
+        {
+            _check_index( i );
+            return _data[i];
+        }
+
+        const T& at( size_type i ) const
+        {
+            _check_index( i );
+            return _data[i];
+        }
+
+        void reserve( size_type capacity )
+        {
+            if( capacity > _capacity )
+            {
+                _reallocate( 0, capacity );
+            }
+        }
+
+        void clear()
+        {
+            for( size_type i = 0; i < _size; i++ )
+            {
+                _data[i].~T();
+            }
+            _size = 0;
+            _capacity += _front;
+            _data -= _front;
+            _front = 0;
+        }
+
+        template< typename It >
+        void assign( It first, It last )
+        {
+            clear();
+            if constexpr( std::is_base_of_v<std::forward_iterator_tag, typename std::iterator_traits<It>::iterator_category> )
+            {
+                reserve( std::distance( first, last ) );
+            }
+            for( ; first != last; ++first )
+            {
+                emplace_back( *first );
+            }
+        }
+
+        template< typename... Args >
+        T& emplace_back( Args&&... args )
+        {
+            if( _size == _capacity )
+            {
+                // arguments may refer to an element
+                T value( std::forward<Args>( args )... );
+                _grow_back();
+                new( _data + _size ) T( std::move( value ) );
+            }
+            else
+            {
+                new( _data + _size ) T( std::forward<Args>( args )... );
+            }
+            return _data[_size++];
+        }
+
+        void push_back( const T& value ) { emplace_back( value ); }
+        void push_back( T&& value ) { emplace_back( std::move( value ) ); }
+
+        void pop_back()
+        {
+            _data[--_size].~T();
+        }
+
+        void resize( size_type size )
+        {
+            _resize( size, [&]( T* p ) { new( p ) T(); } );
+        }
+
+        void resize( size_type size, const T& value )
+        {
+            _resize( size, [&]( T* p ) { new( p ) T( value ); } );
+        }
+
+        iterator insert( const_iterator pos, const T& value ) { return emplace( pos, value ); }
+        iterator insert( const_iterator pos, T&& value ) { return emplace( pos, std::move( value ) ); }
+
+        template< typename It, typename = typename std::iterator_traits<It>::iterator_category >
+        iterator insert( const_iterator pos, It first, It last )
+        {
+            // append and rotate into place
+            size_type index = pos - begin();
+            size_type oldSize = _size;
+            for( ; first != last; ++first )
+            {
+                emplace_back( *first );
+            }
+            std::rotate( begin() + index, begin() + oldSize, end() );
+            return begin() + index;
+        }
+
+        template< typename... Args >
+        iterator emplace( const_iterator pos, Args&&... args )
+        {
+            if( pos == begin() && !empty() )
+            {
+                T value( std::forward<Args>( args )... );
+                if( _front == 0 )
+                {
+                    _reallocate( std::max( _size, N ), _capacity );
+                }
+                new( _data - 1 ) T( std::move( value ) );
+                _data--;
+                _front--;
+                _capacity++;
+                _size++;
+                return begin();
+            }
+            size_type index = pos - begin();
+            emplace_back( std::forward<Args>( args )... );
+            std::rotate( begin() + index, end() - 1, end() );
+            return begin() + index;
+        }
+
+        iterator erase( const_iterator pos )
+        {
+            return erase( pos, pos + 1 );
+        }
+
+        iterator erase( const_iterator first, const_iterator last )
+        {
+            iterator it = begin() + ( first - begin() );
+            size_type num = last - first;
+            if( it == begin() && num > 0 && num < _size )
+            {
+                // leading elements become free space in front
+                for( size_type i = 0; i < num; i++ )
+                {
+                    _data[i].~T();
+                }
+                _data += num;
+                _front += num;
+                _capacity -= num;
+                _size -= num;
+                return begin();
+            }
+            std::move( it + num, end(), it );
+            for( size_type i = 0; i < num; i++ )
+            {
+                pop_back();
+            }
+            return it;
+        }
+
+        void swap( SmallVector& other )
+        {
+            SmallVector tmp( std::move( other ) );
+            other = std::move( *this );
+            *this = std::move( tmp );
+        }
+
+        /**
+         * Copy of the elements.
+         */
+        std::vector<T> to_vector() const { return std::vector<T>( begin(), end() ); }
+
+        bool operator==( const SmallVector& other ) const
+        {
+            return _size == other._size && std::equal( begin(), end(), other.begin() );
+        }
+        bool operator!=( const SmallVector& other ) const { return !operator==( other ); }
+
+    private:
+        T* _inline() { return reinterpret_cast<T*>( _storage ); }
+        const T* _inline() const { return reinterpret_cast<const T*>( _storage ); }
+
+        void _check_index( size_type i ) const
+        {
+            if( i >= _size )
+            {
+                throw std::out_of_range( "SmallVector index out of range" );
+            }
+        }
+
+        // release heap storage, vector must be empty
+        void _deallocate()
+        {
+            if( !is_inline() )
+            {
+                _resource->deallocate( _data - _front, ( _front + _capacity ) * sizeof( T ), alignof( T ) );
+            }
+            _data = _inline();
+            _capacity = N;
+            _front = 0;
+        }
+
+        // move elements to new heap storage with free space for front elements before them
+        void _reallocate( size_type front, size_type capacity )
+        {
+            T* storage = static_cast<T*>( _resource->allocate( ( front + capacity ) * sizeof( T ), alignof( T ) ) );
+            T* data = storage + front;
+            for( size_type i = 0; i < _size; i++ )
+            {
+                new( data + i ) T( std::move( _data[i] ) );
+                _data[i].~T();
+            }
+            _deallocate();
+            _data = data;
+            _capacity = capacity;
+            _front = front;
+        }
+
+        // make room for one more element at the back
+        void _grow_back()
+        {
+            if( _front >= _size )
+            {
+                // at least half of the storage is free in front, elements are moved there
+                T* storage = _data - _front;
+                for( size_type i = 0; i < _size; i++ )
+                {
+                    new( storage + i ) T( std::move( _data[i] ) );
+                    _data[i].~T();
+                }
+                _data = storage;
+                _capacity += _front;
+                _front = 0;
+            }
+            else
+            {
+                _reallocate( 0, _capacity * 2 );
+            }
+        }
+
+        // take elements of other with the same resource, this vector must be empty and inline
+        void _steal( SmallVector& other ) noexcept
+        {
+            if( other.is_inline() )
+            {
+                for( size_type i = 0; i < other._size; i++ )
+                {
+                    new( _data + i ) T( std::move( other._data[i] ) );
+                }
+                _size = other._size;
+                other.clear();
+            }
+            else
+            {
+                _data = other._data;
+                _size = other._size;
+                _capacity = other._capacity;
+                _front = other._front;
+                other._data = other._inline();
+                other._size = 0;
+                other._capacity = N;
+                other._front = 0;
+            }
+        }
+
+        template< typename Construct >
+        void _resize( size_type size, Construct construct )
+        {
+            while( _size > size )
+            {
+                pop_back();
+            }
+            reserve( size );
+            for( ; _size < size; _size++ )
+            {
+                construct( _data + _size );
+            }
+        }
+
+        T* _data;
+        size_type _size;
+        size_type _capacity;
+        size_type _front;   // free elements in front of _data
+        std::pmr::memory_resource* _resource;
+        alignas( T ) unsigned char _storage[N * sizeof( T )];
+    };
 }
 
+class TlvView;
+class TlvTape;
+class FlatTlv;
+class TlvSnapshot;
+
 class Tlv
 {
 public:
@@ -61,6 +473,9 @@ public:
 
     private:
         friend class Tlv;
+        friend class ::TlvView;
+        friend class ::TlvTape;
+        friend class ::FlatTlv;
 
         Status( const Code, const size_t length );
         Status( const Code, const size_t length, const char*, ... )
@@ -185,14 +600,93 @@ public:
         uint32_t _value;
     };
 
-    typedef std::vector<uint8_t> Value;
-    typedef std::vector<Tlv> ChildContainer;
-    typedef std::vector<Tlv>::iterator ChildIterator;
+    /**
+     * Non-owning reference to a contiguous sequence of bytes.
+     */
+    class ByteSpan
+    {
+    public:
+        ByteSpan() : _data( nullptr ), _size( 0 ) {}
+        ByteSpan( const uint8_t* data, size_t size ) : _data( data ), _size( size ) {}
+        ByteSpan( const std::vector<uint8_t>& data ) : _data( data.data() ), _size( data.size() ) {}
+        template< size_t N >
+        ByteSpan( const LibtlvUtil::SmallVector<uint8_t, N>& data ) : _data( data.data() ), _size( data.size() ) {}
+
+        const uint8_t* data() const { return _data; }
+        size_t size() const { return _size; }
+        bool empty() const { return _size == 0; }
+
+        const uint8_t* begin() const { return _data; }
+        const uint8_t* end() const { return _data + _size; }
+        uint8_t operator[]( size_t i ) const { return _data[i]; }
+
+        /**
+         * Copy of the referenced bytes.
+         */
+        std::vector<uint8_t> to_vector() const { return std::vector<uint8_t>( begin(), end() ); }
+
+    private:
+        const uint8_t* _data;
+        size_t _size;
+    };
+
+    /**
+     * Encoded tree as a list of byte segments for scatter-gather output (writev, sendmsg), see dump_gather.
+     * Headers and small values are copied into a scratch buffer owned by the list, larger values
+     * reference the value buffers of the tree. Segments are valid as long as the list exists and the
+     * tree is not modified.
+     */
+    class GatherList
+    {
+    public:
+        GatherList() : _size( 0 ) {}
+        GatherList( GatherList&& ) = default;
+        GatherList& operator=( GatherList&& ) = default;
+        GatherList( const GatherList& ) = delete;
+        GatherList& operator=( const GatherList& ) = delete;
+
+        /**
+         * Segments in output order, their concatenation is the encoded tree.
+         */
+        const std::vector<ByteSpan>& segments() const { return _segments; }
+
+        /**
+         * Total number of encoded bytes.
+         */
+        size_t size() const { return _size; }
+
+        /**
+         * Copy of the concatenated segments.
+         */
+        std::vector<uint8_t> to_vector() const;
+
+    private:
+        std::vector<uint8_t> _scratch;
+        std::vector<ByteSpan> _segments;
+        size_t _size;
+
+        friend class Tlv;
+    };
+
+    /**
+     * Values and child lists allocate from the memory resource of their node, which allows to parse
+     * whole trees into an arena (see parse). Nodes created by constructors use the default resource.
+     * Values of up to 16 bytes and up to 4 children are stored inside the node without allocation.
+     */
+    typedef LibtlvUtil::SmallVector<uint8_t, 16> Value;
+    typedef LibtlvUtil::SmallVector<Tlv, 4> ChildContainer;
+    typedef Tlv* ChildIterator;     // ChildContainer::iterator, Tlv is incomplete here
+
+    /**
+     * Shared input buffer, nodes parsed from it keep a reference and encode unchanged subtrees verbatim.
+     */
+    typedef std::shared_ptr<const std::vector<uint8_t>> Source;
 
     explicit Tlv();
     explicit Tlv( const Tag );
     explicit Tlv( const Tag, const Value& );
     explicit Tlv( const Tag, const Value&& );
+    explicit Tlv( const Tag, const std::vector<uint8_t>& );
     explicit Tlv( const Tag, const uint8_t*, const size_t );
     explicit Tlv( const Tag, const char* );
     explicit Tlv( const Tag, const std::string& );
@@ -214,8 +708,17 @@ public:
 
     Tlv& operator=( const Tlv& );
     Tlv& operator=( Tlv&& );
+    /**
+     * Structural comparison of tag, value and children, the parents are not compared.
+     * Subtrees with different hashes are unequal without comparing their contents.
+     */
     bool operator==( const Tlv& ) const;
     bool operator!=( const Tlv& ) const;
+    /**
+     * Hash of tag, value and children, consistent with operator==. It is cached per node and
+     * recomputed only for nodes changed since, so hashing an unchanged tree again is O(1).
+     */
+    size_t hash() const;
 
     // TODO: adopt depth option also for deep searches / removal
     enum Depth : int
@@ -224,6 +727,8 @@ public:
         Deep = std::numeric_limits<int>::max()
     };
 
+    class Projection;
+
     /**
      * Parse raw data into TLV
      * @param[in] data  - input buffer
@@ -231,9 +736,10 @@ public:
      * @param[out] s    - operation status
      * @param[out] len  - parsed data length
      * @param[in] depth - parse sub-items recursively up to specified depth
+     * @param[in] resource - memory resource for nodes, values and child lists of the tree (default resource if null)
      * @return Parsed TLV tree
      */
-    static Tlv parse( const uint8_t *data, const size_t size, Status &s, int depth = Deep );
+    static Tlv parse( const uint8_t *data, const size_t size, Status &s, int depth = Deep, std::pmr::memory_resource *resource = nullptr );
 
     /**
      * Parse raw data into set of TLV nodes (if tags come one after another)
@@ -242,9 +748,10 @@ public:
      * @param[out] s    - operation status
      * @param[out] len  - parsed data length
      * @param[in] depth - parse sub-items recursively up to specified depth
+     * @param[in] resource - memory resource for nodes, values and child lists of the tree (default resource if null)
      * @return Parsed TLV tree
      */
-    static Tlv parse_all( const uint8_t *data, const size_t size, Status &s, int depth = Deep );
+    static Tlv parse_all( const uint8_t *data, const size_t size, Status &s, int depth = Deep, std::pmr::memory_resource *resource = nullptr );
 
     /**
      * Parse raw data into current TLV object
@@ -252,9 +759,10 @@ public:
      * @param[in] size  - input size
      * @param[out] len  - parsed data length
      * @param[in] depth - parse sub-items recursively up to specified depth
+     * @param[in] resource - memory resource for nodes, values and child lists of the tree (default resource if null)
      * @return operation status
      */
-    Status parse( const uint8_t *data, const size_t size, int depth = Deep );
+    Status parse( const uint8_t *data, const size_t size, int depth = Deep, std::pmr::memory_resource *resource = nullptr );
 
     /**
      * Parse raw data into set of TLV nodes (if tags come one after another)
@@ -262,9 +770,125 @@ public:
      * @param[in] size  - input size
      * @param[out] len  - parsed data length
      * @param[in] depth - parse sub-items recursively up to specified depth
+     * @param[in] resource - memory resource for nodes, values and child lists of the tree (default resource if null)
      * @return opreation status
      */
-    Status parse_all( const uint8_t *data, const size_t size, int depth = Deep );
+    Status parse_all( const uint8_t *data, const size_t size, int depth = Deep, std::pmr::memory_resource *resource = nullptr );
+
+    /**
+     * Parse raw data into TLV, only nodes selected by projection and their ancestors are materialized.
+     * Values of other nodes are not copied and subtrees that cannot contain selected nodes are skipped
+     * without decoding them. The root node is always kept, projection paths start with its tag.
+     * @param[in] data       - input buffer
+     * @param[in] size       - input size
+     * @param[out] s         - operation status
+     * @param[in] projection - selected nodes
+     * @param[in] depth      - parse sub-items recursively up to specified depth
+     * @param[in] resource   - memory resource for nodes, values and child lists of the tree (default resource if null)
+     * @return Parsed TLV tree
+     */
+    static Tlv parse( const uint8_t *data, const size_t size, Status &s, const Projection &projection, int depth = Deep, std::pmr::memory_resource *resource = nullptr );
+
+    /**
+     * Parse raw data into set of TLV nodes, only nodes selected by projection and their ancestors are
+     * materialized, see parse with projection. Projection paths start with tags of top-level nodes.
+     * @param[in] data       - input buffer
+     * @param[in] size       - input size
+     * @param[out] s         - operation status
+     * @param[in] projection - selected nodes
+     * @param[in] depth      - parse sub-items recursively up to specified depth
+     * @param[in] resource   - memory resource for nodes, values and child lists of the tree (default resource if null)
+     * @return Parsed TLV tree
+     */
+    static Tlv parse_all( const uint8_t *data, const size_t size, Status &s, const Projection &projection, int depth = Deep, std::pmr::memory_resource *resource = nullptr );
+
+    /**
+     * Parse raw data into current TLV object, see parse with projection
+     * @param[in] data       - input buffer
+     * @param[in] size       - input size
+     * @param[in] projection - selected nodes
+     * @param[in] depth      - parse sub-items recursively up to specified depth
+     * @param[in] resource   - memory resource for nodes, values and child lists of the tree (default resource if null)
+     * @return operation status
+     */
+    Status parse( const uint8_t *data, const size_t size, const Projection &projection, int depth = Deep, std::pmr::memory_resource *resource = nullptr );
+
+    /**
+     * Parse raw data into set of TLV nodes, see parse_all with projection
+     * @param[in] data       - input buffer
+     * @param[in] size       - input size
+     * @param[in] projection - selected nodes
+     * @param[in] depth      - parse sub-items recursively up to specified depth
+     * @param[in] resource   - memory resource for nodes, values and child lists of the tree (default resource if null)
+     * @return operation status
+     */
+    Status parse_all( const uint8_t *data, const size_t size, const Projection &projection, int depth = Deep, std::pmr::memory_resource *resource = nullptr );
+
+    /**
+     * Parse shared input buffer into TLV. Nodes keep a reference to the buffer and remember their encoding,
+     * dump and the other encoders copy subtrees that did not change since parsing verbatim from the buffer,
+     * including non-minimal and indefinite length fields. Changed nodes and their ancestors are encoded as usual.
+     * @param[in] source   - input buffer
+     * @param[out] s       - operation status
+     * @param[in] depth    - parse sub-items recursively up to specified depth
+     * @param[in] resource - memory resource for nodes, values and child lists of the tree (default resource if null)
+     * @return Parsed TLV tree
+     */
+    static Tlv parse( const Source& source, Status &s, int depth = Deep, std::pmr::memory_resource *resource = nullptr );
+
+    /**
+     * Parse shared input buffer into set of TLV nodes, see parse with source.
+     * @param[in] source   - input buffer
+     * @param[out] s       - operation status
+     * @param[in] depth    - parse sub-items recursively up to specified depth
+     * @param[in] resource - memory resource for nodes, values and child lists of the tree (default resource if null)
+     * @return Parsed TLV tree
+     */
+    static Tlv parse_all( const Source& source, Status &s, int depth = Deep, std::pmr::memory_resource *resource = nullptr );
+
+    /**
+     * Parse shared input buffer into current TLV object, see parse with source.
+     * @param[in] source   - input buffer
+     * @param[in] depth    - parse sub-items recursively up to specified depth
+     * @param[in] resource - memory resource for nodes, values and child lists of the tree (default resource if null)
+     * @return operation status
+     */
+    Status parse( const Source& source, int depth = Deep, std::pmr::memory_resource *resource = nullptr );
+
+    /**
+     * Parse shared input buffer into set of TLV nodes, see parse with source.
+     * @param[in] source   - input buffer
+     * @param[in] depth    - parse sub-items recursively up to specified depth
+     * @param[in] resource - memory resource for nodes, values and child lists of the tree (default resource if null)
+     * @return operation status
+     */
+    Status parse_all( const Source& source, int depth = Deep, std::pmr::memory_resource *resource = nullptr );
+
+    /**
+     * Parse raw data into set of TLV nodes like parse_all, using multiple threads. Boundaries of top-level
+     * nodes are found by a pass over their headers, chunks of top-level nodes are then parsed in parallel
+     * and their nodes are added to the root in order. Small inputs are parsed on the calling thread.
+     * @param[in] data        - input buffer
+     * @param[in] size        - input size
+     * @param[out] s          - operation status
+     * @param[in] depth       - parse sub-items recursively up to specified depth
+     * @param[in] num_threads - maximum number of threads, hardware concurrency if 0
+     * @param[in] resource    - thread safe memory resource for nodes, values and child lists of the tree (default resource if null)
+     * @return Parsed TLV tree
+     */
+    static Tlv parse_all_parallel( const uint8_t *data, const size_t size, Status &s, int depth = Deep, unsigned num_threads = 0,
+                                   std::pmr::memory_resource *resource = nullptr );
+
+    /**
+     * Parse raw data into set of TLV nodes using multiple threads, see parse_all_parallel
+     * @param[in] data        - input buffer
+     * @param[in] size        - input size
+     * @param[in] depth       - parse sub-items recursively up to specified depth
+     * @param[in] num_threads - maximum number of threads, hardware concurrency if 0
+     * @param[in] resource    - thread safe memory resource for nodes, values and child lists of the tree (default resource if null)
+     * @return operation status
+     */
+    Status parse_all_parallel( const uint8_t *data, const size_t size, int depth = Deep, unsigned num_threads = 0, std::pmr::memory_resource *resource = nullptr );
 
     /**
      * Parse formatted TLV data, format according to dump_formatted. Behavior is as for
@@ -272,35 +896,39 @@ public:
      * @param[in] data  - input buffer
      * @param[in] size  - input size
      * @param[out] s    - operation status
+     * @param[in] resource - memory resource for nodes, values and child lists of the tree (default resource if null)
      * @return opreation status
      */
-    static Tlv parse_formatted( const uint8_t *data, const size_t size, Status &s );
+    static Tlv parse_formatted( const uint8_t *data, const size_t size, Status &s, std::pmr::memory_resource *resource = nullptr );
 
     /**
      * Parse formatted TLV data, format according to dump_formatted. Behavior is as for
      * parse_all, up to the maximum depth.
      * @param[in] data  - input string
      * @param[out] s    - operation status
+     * @param[in] resource - memory resource for nodes, values and child lists of the tree (default resource if null)
      * @return opreation status
      */
-    static Tlv parse_formatted( std::string_view data, Status &s );
+    static Tlv parse_formatted( std::string_view data, Status &s, std::pmr::memory_resource *resource = nullptr );
 
     /**
      * Parse formatted TLV data, format according to dump_formatted. Behavior is as for
      * parse_all, up to the maximum depth.
      * @param[in] data  - input buffer
      * @param[in] size  - input size
+     * @param[in] resource - memory resource for nodes, values and child lists of the tree (default resource if null)
      * @return opreation status
      */
-    Status parse_formatted( const uint8_t *data, const size_t size );
+    Status parse_formatted( const uint8_t *data, const size_t size, std::pmr::memory_resource *resource = nullptr );
 
     /**
      * Parse formatted TLV data, format according to dump_formatted. Behavior is as for
      * parse_all, up to the maximum depth.
      * @param[in] data  - input string
+     * @param[in] resource - memory resource for nodes, values and child lists of the tree (default resource if null)
      * @return opreation status
      */
-    Status parse_formatted( std::string_view data );
+    Status parse_formatted( std::string_view data, std::pmr::memory_resource *resource = nullptr );
 
     /**
      * Parses the value of node into a subtree of TLV nodes.
@@ -309,77 +937,312 @@ public:
     Status expand( int depth = Deep );
 
     /**
-     * Build tree into byte sequence (binary encoded)
+     * Selection of nodes for parsing. A node is selected if its tag is one of the selected tags,
+     * at any depth, or if it is reached by one of the selected tag paths. Selected nodes are
+     * parsed with their whole subtree.
      */
-    std::vector<uint8_t> dump() const;
+    class Projection
+    {
+    public:
+        Projection() = default;
+        explicit Projection( std::initializer_list<Tag> tags );
 
-    /**
-     * Build tree into ASCII formatted text, using indentation and whitespace instead of explicit length encoding.
-     */
-    std::string dump_formatted() const;
+        /**
+         * Select nodes with tag at any depth
+         */
+        Projection& add( const Tag tag );
 
-    /***********
-     * Capacity
-     ***********/
+        /**
+         * Select nodes by path of tags, starting with the tag of a top-level node
+         */
+        Projection& add_path( const std::vector<Tag>& path );
 
-    /**
-     * A node is considered empty if has no tag, no value and no children.
-     */
-    bool empty() const;
+        /**
+         * An empty projection selects no nodes
+         */
+        bool empty() const { return _tags.empty() && _paths.empty(); }
 
-    /**
-     * True if Tlv node is not empty.
-     */
-    operator bool() const;
+    private:
+        friend class ::TlvTape;
 
-    /**
-     * Is tag set
-     */
-    bool has_tag() const;
+        // branch holds the tags of the ancestors of a node at depth branch.size() + 1
+        bool selects( const Tag tag, const std::vector<uint32_t>& branch ) const;
+        bool descends( const Tag tag, const std::vector<uint32_t>& branch ) const;
 
-    /**
-     * Has value
-     */
-    bool has_value() const;
+        std::vector<uint32_t> _tags;    // sorted
+        std::vector<std::vector<uint32_t>> _paths;
+    };
 
     /**
-     * Data size in bytes
+     * Incremental parser for TLV data that arrives in arbitrary chunks, e.g. from a socket.
+     * Top-level nodes are passed to the callback as soon as they are complete. Tag and length
+     * decoding state is kept across chunks, only the bytes of an incomplete top-level node are buffered.
+     * The end of indefinite length nodes is searched incrementally as their content arrives.
      */
-    size_t value_size() const;
+    class StreamParser
+    {
+    public:
+        typedef std::function<void(Tlv&)> Callback;
 
-    /**
-     * Has parent node
-     */
-    bool has_parent() const;
+        /**
+         * @param[in] callback        - invoked for each completed top-level node
+         * @param[in] depth           - parse sub-items recursively up to specified depth
+         * @param[in] max_record_size - maximum encoded size of a top-level node, larger nodes are rejected
+         */
+        explicit StreamParser( Callback callback, int depth = Deep, size_t max_record_size = std::numeric_limits<size_t>::max() );
 
-    /**
-     * Has children nodes
-     */
-    bool has_children() const;
+        /**
+         * Feed next chunk of input data. After an error, the parser keeps returning the
+         * error until it is reset.
+         * @param[in] data  - input buffer
+         * @param[in] size  - input size
+         * @return operation status, parsed length is the number of bytes consumed since the last reset
+         */
+        Status feed( const uint8_t *data, const size_t size );
 
-    /**
-     * Number of direct child nodes
-     */
-    size_t num_children() const;
+        /**
+         * True if an incomplete top-level node is pending.
+         */
+        bool pending() const;
 
-    /**
-     * Size of tree including this node
-     */
-    size_t tree_size() const;
+        /**
+         * Discard pending data and errors.
+         */
+        void reset();
 
-    /****************
-     * Element access
-     ****************/
+    private:
+        enum class State
+        {
+            Tag,
+            TagNext,
+            Length,
+            LengthNext,
+            Value,
+            Contents        // indefinite length, until the matching end-of-contents
+        };
 
-    /**
-     *  Begin iterator to child nodes
-     */
-    ChildIterator begin();
+        Status _emit( const uint8_t* begin, const uint8_t* end );
+        Status _fail( Status status );
+
+        Callback _callback;
+        int _depth;
+        size_t _max_record_size;
+
+        State _state;
+        Status _status;
+        size_t _offset;         // consumed bytes
+        size_t _record_offset;  // offset of the pending top-level node
+        uint32_t _tag;
+        size_t _tag_size;
+        uint32_t _length;
+        size_t _length_size;    // remaining bytes of long form length
+        size_t _header_size;
+        size_t _eoc_pos;        // end-of-contents search state of indefinite length nodes
+        size_t _eoc_depth;
+        std::vector<uint8_t> _record;
+    };
 
     /**
-     * End iterator to child nodes
+     * Encoder that writes nodes as they are produced, without building a tree. The length form of
+     * constructed nodes is selected per writer:
+     *  - Compact:    reserved long form length field, patched and compacted to the minimal form (same
+     *                encoding as dump) when the node is closed, which moves the node's content once per level
+     *  - Reserved:   reserved long form length field, patched when the node is closed. Files must be
+     *                seekable and not opened for appending, Compact falls back to this form for files.
+     *  - Indefinite: indefinite length, closed by end-of-contents. Nothing is patched, so output can be
+     *                a pipe or socket and the total size need not be known.
      */
-    ChildIterator end();
+    class Writer
+    {
+    public:
+        enum Form
+        {
+            Compact,
+            Reserved,
+            Indefinite
+        };
+
+        /**
+         * @param[out] out  - output vector, nodes are appended
+         * @param[in]  form - length form of constructed nodes
+         */
+        explicit Writer( std::vector<uint8_t>& out, Form form = Compact );
+
+        /**
+         * @param[out] file - output file, nodes are written at the current position
+         * @param[in]  form - length form of constructed nodes
+         */
+        explicit Writer( std::FILE* file, Form form = Reserved );
+
+        /**
+         * Open a constructed node, following nodes are its children until it is closed.
+         * After an error, all operations keep returning the error.
+         * @param[in] tag - tag of the node
+         * @return operation status, parsed length is the number of bytes written
+         */
+        Status begin_constructed( const Tag tag );
+
+        /**
+         * Write a node with the given value.
+         * @param[in] tag   - tag of the node
+         * @param[in] value - value bytes
+         * @return operation status, parsed length is the number of bytes written
+         */
+        Status primitive( const Tag tag, ByteSpan value );
+
+        /**
+         * Close the most recently opened constructed node and write its length or end-of-contents.
+         * @return operation status, parsed length is the number of bytes written
+         */
+        Status end_constructed();
+
+        /**
+         * Check that all constructed nodes are closed and flush file output.
+         * @return operation status, parsed length is the number of bytes written
+         */
+        Status finish();
+
+        /**
+         * Number of open constructed nodes.
+         */
+        size_t depth() const { return _open.size(); }
+
+    private:
+        struct Open
+        {
+            Tag tag;
+            size_t header_offset;   // offset in the output vector or position in the file
+        };
+
+        Status _append( const uint8_t* data, size_t len );
+        Status _fail( Status status );
+        Status _done() const;
+
+        std::vector<uint8_t>* _out;
+        std::FILE* _file;
+        Form _form;
+        size_t _written;
+        std::vector<Open> _open;
+        Status _status;
+    };
+
+    /**
+     * Build tree into byte sequence (binary encoded). Unchanged nodes parsed from a Source are
+     * copied from it, all encoders below behave the same.
+     */
+    std::vector<uint8_t> dump() const;
+
+    /**
+     * Build tree into caller provided buffer (binary encoded). Nothing is written if the buffer is too small.
+     * @param[out] dst - output buffer
+     * @param[in]  cap - capacity of output buffer
+     * @return Number of bytes written, or the size needed if it exceeds the capacity
+     */
+    size_t dump_into( uint8_t* dst, size_t cap ) const;
+
+    /**
+     * Build tree into output iterator (binary encoded). Headers and values are written as blocks.
+     * @param[out] out - output iterator
+     * @return Number of bytes written
+     */
+    template< typename OutputIt >
+    size_t dump_into( OutputIt out ) const;
+
+    /**
+     * Append binary encoded tree to a vector, which grows at most once.
+     * @param[out] out - output vector
+     * @return Number of bytes appended
+     */
+    size_t dump_append( std::vector<uint8_t>& out ) const;
+
+    /**
+     * Build tree into a list of segments without copying values larger than the threshold.
+     * Adjacent copied bytes are merged into one segment.
+     * @param[in] copy_threshold - values up to this size are copied next to their header
+     * @return Segment list referencing this tree, see GatherList
+     */
+    GatherList dump_gather( size_t copy_threshold = 32 ) const;
+
+    /**
+     * Build tree into byte sequence like dump, in one post-order pass that writes the encoding from the
+     * end toward the beginning, so the length of each node is known when its header is written.
+     * Cached sizes are neither used nor updated.
+     */
+    std::vector<uint8_t> dump_reverse() const;
+
+    /**
+     * Size of the binary encoding of the tree, see dump. Sizes are cached per node and
+     * only recomputed for nodes that changed since they were last computed.
+     */
+    size_t encoded_size() const;
+
+    /**
+     * Build tree into ASCII formatted text, using indentation and whitespace instead of explicit length encoding.
+     */
+    std::string dump_formatted() const;
+
+    /***********
+     * Capacity
+     ***********/
+
+    /**
+     * A node is considered empty if has no tag, no value and no children.
+     */
+    bool empty() const;
+
+    /**
+     * True if Tlv node is not empty.
+     */
+    operator bool() const;
+
+    /**
+     * Is tag set
+     */
+    bool has_tag() const;
+
+    /**
+     * Has value
+     */
+    bool has_value() const;
+
+    /**
+     * Data size in bytes
+     */
+    size_t value_size() const;
+
+    /**
+     * Has parent node
+     */
+    bool has_parent() const;
+
+    /**
+     * Has children nodes
+     */
+    bool has_children() const;
+
+    /**
+     * Number of direct child nodes
+     */
+    size_t num_children() const;
+
+    /**
+     * Size of tree including this node
+     */
+    size_t tree_size() const;
+
+    /****************
+     * Element access
+     ****************/
+
+    /**
+     *  Begin iterator to child nodes
+     */
+    ChildIterator begin();
+
+    /**
+     * End iterator to child nodes
+     */
+    ChildIterator end();
 
     /**
      * First node
@@ -402,7 +1265,8 @@ public:
     const ChildContainer& children() const;
 
     /**
-     * Node value
+     * Node value. Mutable access marks the encoded size of the node as changed, the
+     * reference should not be kept to change the value after the tree was dumped.
      */
     const Value& value() const;
     Value& value();
@@ -438,6 +1302,7 @@ public:
      **************/
     void set_value( const Value& value );
     void set_value( Value&& value );
+    void set_value( const std::vector<uint8_t>& value );
     void set_tag( const Tag& tag );
 
     /***********
@@ -465,9 +1330,86 @@ public:
     void bfs( std::function<TraversalAction(Tlv&)> ) const;
     void bfs( std::function<TraversalAction(Tlv&, int depth)> ) const;
 
+    /**
+     * Event handler for scan. Events are reported in document order.
+     * Handlers return one of defined TraversalActions, Prune on a constructed node skips its subtree.
+     */
+    class ScanHandler
+    {
+    public:
+        virtual ~ScanHandler() = default;
+
+        /**
+         * Constructed node within scan depth, children follow until on_end_constructed.
+         * @param[in] tag    - node tag
+         * @param[in] offset - offset of the value in the input buffer
+         * @param[in] len    - length of the value
+         */
+        virtual TraversalAction on_begin_constructed( const Tag tag, size_t offset, size_t len );
+
+        /**
+         * Primitive node, or constructed node beyond scan depth.
+         * The value references the input buffer.
+         */
+        virtual TraversalAction on_primitive( const Tag tag, ByteSpan value );
+
+        /**
+         * End of constructed node, not reported if the node was pruned.
+         */
+        virtual void on_end_constructed( const Tag tag );
+    };
+
+    /**
+     * Scan raw data (like parse_all) and report nodes to handler instead of building a tree.
+     * Nothing is allocated unless nesting is unusually deep. Events up to an error have already been
+     * reported when an error status is returned.
+     * @param[in] data    - input buffer
+     * @param[in] size    - input size
+     * @param[in] handler - event handler
+     * @param[in] depth   - scan sub-items recursively up to specified depth
+     * @return operation status, on Break the parsed length ends after the current node
+     */
+    static Status scan( const uint8_t *data, const size_t size, ScanHandler &handler, int depth = Deep );
+
+    /**
+     * Check that raw data is well-formed, like parse_all but without building a tree. Tags must be complete
+     * and lengths of nodes within their parent. Errors and parsed length are the same as for parse_all.
+     * Valid data is checked without allocation, unless nesting is unusually deep.
+     * @param[in] data  - input buffer
+     * @param[in] size  - input size
+     * @param[out] s    - operation status
+     * @param[in] depth - validate sub-items recursively up to specified depth
+     * @return true if the data is valid
+     */
+    static bool validate( const uint8_t *data, const size_t size, Status &s, int depth = Deep );
+
+    /**
+     * Overwrite the value of a node inside encoded data, without building a tree. The node is located by
+     * a header-only walk along the tag path, nodes before it are skipped without decoding their content.
+     * @param[in,out] data  - encoded buffer
+     * @param[in]     size  - buffer size
+     * @param[in]     path  - tags from a top-level node down to the patched node, the first node with
+     *                        matching tag is taken on each level
+     * @param[in]     value - new value, must have the size of the current value
+     * @return operation status, parsed length is the offset of the value
+     */
+    static Status patch_value( uint8_t *data, const size_t size, const std::vector<Tag>& path, ByteSpan value );
+
+    /**
+     * Replace the value of a node inside encoded data like patch_value, the value may change its size.
+     * The following data is moved and length fields of the node and its ancestors are rewritten. Length
+     * fields keep their size if the new length fits, indefinite length nodes need no rewrite.
+     * @param[in,out] data  - encoded buffer
+     * @param[in]     path  - tags from a top-level node down to the patched node
+     * @param[in]     value - new value
+     * @return operation status, parsed length is the offset of the value
+     */
+    static Status patch_value( std::vector<uint8_t>& data, const std::vector<Tag>& path, ByteSpan value );
+
     /**
      * Find one child node with matching tag. If none is found an empty node is returned.
-     * Only direct children are considered.
+     * Only direct children are considered. Nodes with many children build an index of their
+     * children by tag on the first lookup, so that later lookups of direct children are O(1).
      */
     Tlv find( const Tag tag, int maxDepth = DirectChildren ) const;
 
@@ -483,6 +1425,12 @@ public:
      */
     size_t remove( const Tag tag );
 
+    /**
+     * Remove all child nodes for which predicate returns true, in a single pass over the children.
+     * The number of removed children is returned. The predicate must not modify the tree.
+     */
+    size_t remove_if( std::function<bool(const Tlv&)> predicate );
+
     /***********
      * Data Modifiers
      ***********/
@@ -493,7 +1441,7 @@ public:
     void set_parent( Tlv& parent );
 
     /**
-     * Add new item to the beginning of children list
+     * Add new item to the beginning of children list, amortized O(1)
      */
     void push_front( Tlv& child );
     void push_front( Tlv&& child );
@@ -505,7 +1453,7 @@ public:
     void push_back( Tlv&& child );
 
     /**
-     * Remove first child node
+     * Remove first child node, O(1)
      */
     void pop_front();
 
@@ -515,7 +1463,8 @@ public:
     void pop_back();
 
     /**
-     * Detach node from parent
+     * Detach node from parent. The node is found in O(1), removing the first or last child is O(1),
+     * other children move the following siblings. Use remove_if to remove many children.
      */
     void detach();
 
@@ -543,21 +1492,580 @@ public:
      */
     void reset();
 
+    /**
+     * Read only copy of this node and its descendants, which shares the nodes with the tree until
+     * they are modified. Taking a snapshot copies the list of direct children. Modifications of the
+     * tree copy the nodes on the path down to the modified node, that are still shared with a
+     * snapshot, and the handle used for the modification moves to the copy. Other handles of the
+     * tree to a copied node keep referring to the snapshot version for reading, but modify the copy.
+     *
+     * The snapshot is only accessed through TlvSnapshot handles, which cannot modify nodes, so it
+     * can be read on other threads while the tree is modified. The snapshot and the tree share the
+     * reference counts of their nodes, so this requires the library to be built with the default
+     * LIBTLV_ATOMIC_REFCOUNT=ON.
+     */
+    TlvSnapshot snapshot() const;
+
+    /**
+     * Deep copy of this node and its descendants without parent. Nodes, values and child lists are
+     * placed into one allocation from resource, or from the default resource if it is null. It is
+     * released when all nodes of the copy are destroyed.
+     */
+    Tlv clone( std::pmr::memory_resource* resource = nullptr ) const;
+
 private:
+    friend class TlvView;
+    friend class TlvTape;
+    friend class FlatTlv;
+
     struct Data;
-    std::shared_ptr<Data> data_;
+
+    // Intrusive reference to a node, the count is kept in the node. Counts are atomic unless the
+    // library is built with LIBTLV_ATOMIC_REFCOUNT=0, then trees must be confined to one thread.
+    class DataRef
+    {
+    public:
+        DataRef() : _data( nullptr ) {}
+        explicit DataRef( Data* data );
+        DataRef( const DataRef& other );
+        DataRef( DataRef&& other ) noexcept : _data( other._data ) { other._data = nullptr; }
+        DataRef& operator=( const DataRef& other );
+        DataRef& operator=( DataRef&& other ) noexcept;
+        ~DataRef();
+
+        Data* get() const { return _data; }
+        Data* operator->() const { return _data; }
+        Data& operator*() const { return *_data; }
+        explicit operator bool() const { return _data != nullptr; }
+        bool operator==( const DataRef& other ) const { return _data == other._data; }
+
+    private:
+        Data* _data;
+    };
+
+    DataRef data_;
     class Parser;
     class FormattedParser;
 
-    explicit Tlv( const std::shared_ptr<Data> &data );
-    explicit Tlv( std::shared_ptr<Data> &&data );
+    explicit Tlv( DataRef &&data );
+
+    // node allocated from resource, null for default resource
+    static Tlv _make( std::pmr::memory_resource* resource );
+    std::pmr::memory_resource* _resource() const;
 
     template< typename T >
     inline void _dfs_unsafe( T callback ) const;
     template< typename T >
     inline void _dfs_unsafe_depth( T callback ) const;
+    template< typename Visitor >
+    static Status _walk( const uint8_t* begin, const uint8_t* end, const uint8_t* tree_begin, int maxDepth, Visitor& visitor );
 
-    static const Status _parse( Tlv& root, const uint8_t* begin, const uint8_t* end, const uint8_t* tree_begin, int maxDepth = std::numeric_limits<int>::max() );
-    static const Status _parse_one( Tlv& root, const uint8_t* begin, const uint8_t* end, const uint8_t* tree_begin, int maxDepth = std::numeric_limits<int>::max() );
+    static const Status _parse( Tlv& root, const uint8_t* begin, const uint8_t* end, const uint8_t* tree_begin, int maxDepth = std::numeric_limits<int>::max(),
+                                const Projection* projection = nullptr, const Source* source = nullptr );
+    static const Status _parse_one( Tlv& root, const uint8_t* begin, const uint8_t* end, const uint8_t* tree_begin, int maxDepth = std::numeric_limits<int>::max(),
+                                    const Projection* projection = nullptr, const Source* source = nullptr );
     static const Status _parse_formatted( Tlv& root, std::string_view data );
+    // encoded nodes along a tag path, see patch_value
+    struct PathNode;
+    static Status _locate( const uint8_t* data, size_t size, const std::vector<Tag>& path, std::vector<PathNode>& nodes );
+    // nodes built from a source remember their encoding in it
+    static void _build( Tlv& root, const TlvTape& tape, uint32_t first, uint32_t last, const Source* source = nullptr );
+
+    // write encoded tree as blocks of header and value bytes
+    template< typename Sink >
+    void _write( Sink sink ) const;
+    void _dump( void (*write)( void* context, const uint8_t* data, size_t len ), void* context ) const;
+
+    // encoded size cache, changes are marked up the parent chain and end verbatim encoding from the source
+    static size_t _payload_size( const Data* root );
+    static void _invalidate( Data* node );
+    // cached subtree hash, invalidated together with the size
+    static uint64_t _hash( const Data* root );
+
+    // copy on write, see snapshot: shared nodes on the path to a node are copied before it is modified
+    static Data* _unshare( Data* node );
+    void _unshare();
+    // follow a node that was replaced by its copy
+    void _resolve();
+};
+
+template< typename OutputIt >
+size_t Tlv::dump_into( OutputIt out ) const
+{
+    _dump( []( void* context, const uint8_t* data, size_t len )
+    {
+        OutputIt& it = *static_cast<OutputIt*>( context );
+        it = std::copy( data, data + len, it );
+    }, &out );
+    return encoded_size();
+}
+
+inline bool operator==( const Tlv::Value& lhs, const std::vector<uint8_t>& rhs )
+{
+    return lhs.size() == rhs.size() && std::equal( lhs.begin(), lhs.end(), rhs.begin() );
+}
+inline bool operator==( const std::vector<uint8_t>& lhs, const Tlv::Value& rhs ) { return rhs == lhs; }
+inline bool operator!=( const Tlv::Value& lhs, const std::vector<uint8_t>& rhs ) { return !( lhs == rhs ); }
+inline bool operator!=( const std::vector<uint8_t>& lhs, const Tlv::Value& rhs ) { return !( rhs == lhs ); }
+
+namespace std
+{
+template<>
+struct hash<Tlv>
+{
+    size_t operator()( const Tlv& tlv ) const { return tlv.hash(); }
 };
+}
+
+/**
+ * Read-only handle to a node of a snapshot, see Tlv::snapshot.
+ *
+ * Nodes reached from a snapshot handle are snapshot handles too, so reading a snapshot never
+ * copies or modifies the nodes it shares with the tree. Handles keep the snapshot alive.
+ */
+class TlvSnapshot
+{
+public:
+    TlvSnapshot() = default;
+
+    bool empty() const { return _node.empty(); }
+    operator bool() const { return !empty(); }
+
+    bool has_tag() const { return _node.has_tag(); }
+    bool has_value() const { return _node.has_value(); }
+    bool has_children() const { return _node.has_children(); }
+    size_t num_children() const { return _node.num_children(); }
+
+    Tlv::Tag tag() const { return _node.tag(); }
+    const Tlv::Value& value() const { return _node.value(); }
+    size_t value_size() const { return _node.value_size(); }
+    std::string string() const { return _node.string(); }
+
+    /**
+     * Direct child nodes
+     */
+    std::vector<TlvSnapshot> children() const;
+    TlvSnapshot front() const;
+    TlvSnapshot back() const;
+
+    /**
+     * Find child nodes, see Tlv::find and Tlv::find_all
+     */
+    TlvSnapshot find( const Tlv::Tag tag, int maxDepth = Tlv::DirectChildren ) const;
+    std::vector<TlvSnapshot> find_all( const Tlv::Tag tag, int maxDepth = Tlv::DirectChildren, bool findNested = false ) const;
+
+    std::vector<uint8_t> dump() const { return _node.dump(); }
+    size_t encoded_size() const { return _node.encoded_size(); }
+
+    /**
+     * Node of the snapshot is still shared with the given node, i.e. it was not modified since
+     */
+    bool identical( const Tlv& node ) const { return _node.identical( node ); }
+    bool identical( const TlvSnapshot& other ) const { return _node.identical( other._node ); }
+
+private:
+    friend class Tlv;
+    explicit TlvSnapshot( const Tlv& node ) : _node( node ) {}
+
+    Tlv _node;
+};
+
+/**
+ * Read-only view of a TLV tree inside an encoded buffer.
+ *
+ * Views are produced by the same parser as Tlv, but reference the input buffer instead
+ * of copying values into owning nodes. Structure is validated once when the view is
+ * parsed, child nodes are decoded on iteration. Views obtained from a TlvTape look up
+ * child nodes in the tape instead. The input buffer (and tape) must outlive all views
+ * derived from it.
+ */
+class TlvView
+{
+public:
+    class ChildIterator;
+    class ChildRange;
+
+    TlvView();
+
+    /**
+     * Parse raw data into a view of the first TLV node, see Tlv::parse
+     * @param[in] data  - input buffer, must outlive the view
+     * @param[in] size  - input size
+     * @param[out] s    - operation status
+     * @param[in] depth - expand sub-items recursively up to specified depth
+     * @return View of the parsed TLV tree
+     */
+    static TlvView parse( const uint8_t *data, const size_t size, Tlv::Status &s, int depth = Tlv::Deep );
+
+    /**
+     * Parse raw data into a view of a set of TLV nodes, see Tlv::parse_all
+     * @param[in] data  - input buffer, must outlive the view
+     * @param[in] size  - input size
+     * @param[out] s    - operation status
+     * @param[in] depth - expand sub-items recursively up to specified depth
+     * @return View of the parsed TLV tree, with an empty root tag
+     */
+    static TlvView parse_all( const uint8_t *data, const size_t size, Tlv::Status &s, int depth = Tlv::Deep );
+
+    /**
+     * A view is empty if it references no tag, no value and no children.
+     */
+    bool empty() const;
+    operator bool() const { return !empty(); }
+
+    bool has_tag() const { return !_tag.empty(); }
+    bool has_value() const { return !expanded() && _begin != _end; }
+    bool has_children() const;
+
+    /**
+     * Number of direct child nodes, counted by iterating them
+     */
+    size_t num_children() const;
+
+    Tlv::Tag tag() const { return _tag; }
+
+    /**
+     * Node value, empty for constructed nodes that were expanded into children.
+     */
+    Tlv::ByteSpan value() const;
+    size_t value_size() const { return value().size(); }
+
+    /**
+     * Offset of the value relative to the beginning of the parsed buffer
+     */
+    size_t offset() const { return _begin - _tree_begin; }
+
+    /**
+     * Direct child nodes
+     */
+    ChildRange children() const;
+
+    /**
+     * Find first direct child with matching tag. If none is found an empty view is returned.
+     */
+    TlvView find( const Tlv::Tag tag ) const;
+
+    /**
+     * Materialize an owning TLV tree with the same content as this view.
+     * @param[in] resource - memory resource for the tree (default resource if null)
+     */
+    Tlv to_tlv( std::pmr::memory_resource *resource = nullptr ) const;
+
+private:
+    friend class TlvTape;
+    TlvView( Tlv::Tag tag, const uint8_t* begin, const uint8_t* end, const uint8_t* tree_begin, int depth );
+    TlvView( const TlvTape* tape, uint32_t index );
+
+    // constructed nodes within parse depth are expanded into child nodes
+    bool expanded() const { return _depth > 0 && _tag.constructed(); }
+
+    Tlv::Tag _tag;
+    const uint8_t* _begin;
+    const uint8_t* _end;
+    const uint8_t* _tree_begin;
+    int _depth;             // remaining depth of child nodes to expand
+    const TlvTape* _tape;   // tape of the buffer, null if children are decoded
+    uint32_t _index;        // tape entry of the node, npos for the root of a tape
+};
+
+class TlvView::ChildIterator
+{
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = TlvView;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const TlvView*;
+    using reference = const TlvView&;
+
+    ChildIterator();
+
+    reference operator*() const { return _current; }
+    pointer operator->() const { return &_current; }
+    ChildIterator& operator++();
+    ChildIterator operator++( int );
+    bool operator==( const ChildIterator& other ) const;
+    bool operator!=( const ChildIterator& other ) const { return !operator==( other ); }
+
+private:
+    friend class TlvView;
+    friend class FlatTlv;
+    ChildIterator( const uint8_t* begin, const uint8_t* end, const uint8_t* tree_begin, int depth );
+    ChildIterator( const TlvTape* tape, uint32_t first, uint32_t last );
+
+    const uint8_t* _next;
+    const uint8_t* _end;
+    const uint8_t* _tree_begin;
+    int _depth;
+    const TlvTape* _tape;
+    uint32_t _next_index;
+    uint32_t _end_index;
+    TlvView _current;
+};
+
+class TlvView::ChildRange
+{
+public:
+    ChildIterator begin() const { return _begin; }
+    ChildIterator end() const { return ChildIterator(); }
+    bool empty() const { return _begin == ChildIterator(); }
+
+private:
+    friend class TlvView;
+    friend class FlatTlv;
+    ChildRange( ChildIterator begin ) : _begin( begin ) {}
+    ChildIterator _begin;
+};
+
+/**
+ * Structural index of encoded TLV data.
+ *
+ * One linear sweep over the buffer records an entry per node in document order, holding the
+ * decoded tag, header and value offsets, value length and nesting depth. Queries, views and tree
+ * building read the tape instead of decoding headers again. Each entry also holds the index after
+ * its subtree, so subtrees are skipped with one jump. The input buffer must outlive the tape.
+ */
+class TlvTape
+{
+public:
+    struct Entry
+    {
+        Tlv::Tag tag;
+        uint32_t length;        // value length
+        uint32_t depth;         // 1 for top-level nodes
+        uint32_t end;           // index after the last entry of the subtree
+        size_t header_offset;   // offsets relative to the beginning of the buffer
+        size_t value_offset;
+    };
+
+    typedef std::vector<Entry>::const_iterator Iterator;
+
+    static constexpr uint32_t npos = std::numeric_limits<uint32_t>::max();
+
+    TlvTape();
+
+    /**
+     * Index raw data of a set of TLV nodes, see Tlv::parse_all
+     * @param[in] data  - input buffer, must outlive the tape
+     * @param[in] size  - input size
+     * @param[out] s    - operation status
+     * @param[in] depth - index sub-items recursively up to specified depth
+     * @return Tape of the data, empty on errors
+     */
+    static TlvTape index( const uint8_t *data, const size_t size, Tlv::Status &s, int depth = Tlv::Deep );
+
+    /**
+     * Number of entries
+     */
+    size_t size() const { return _entries.size(); }
+    bool empty() const { return _entries.empty(); }
+
+    const Entry& operator[]( uint32_t index ) const { return _entries[index]; }
+    Iterator begin() const { return _entries.begin(); }
+    Iterator end() const { return _entries.end(); }
+
+    /**
+     * True if entries of the child nodes follow the entry, i.e. it is constructed and within the index depth.
+     */
+    bool expanded( uint32_t index ) const;
+
+    /**
+     * Node value, empty for expanded nodes.
+     */
+    Tlv::ByteSpan value( uint32_t index ) const;
+
+    /**
+     * Encoded node, including the header.
+     */
+    Tlv::ByteSpan encoded( uint32_t index ) const;
+
+    /**
+     * Find first node with matching tag in document order, up to the specified depth.
+     * @return Entry index, npos if none is found
+     */
+    uint32_t find( const Tlv::Tag tag, int maxDepth = Tlv::Deep ) const;
+
+    /**
+     * Find all nodes with matching tag, see Tlv::find_all
+     * @return Entry indices in document order
+     */
+    std::vector<uint32_t> find_all( const Tlv::Tag tag, int maxDepth = Tlv::Deep, bool findNested = false ) const;
+
+    /**
+     * View of a node, or with npos a view of the whole set with an empty root tag.
+     * Children of the view are looked up in the tape.
+     */
+    TlvView view( uint32_t index = npos ) const;
+
+    /**
+     * Build an owning TLV tree of a node, or with npos of the whole set (like Tlv::parse_all).
+     * @param[in] resource - memory resource for the tree (default resource if null)
+     */
+    Tlv to_tlv( uint32_t index = npos, std::pmr::memory_resource *resource = nullptr ) const;
+
+private:
+    friend class Tlv;
+    friend class TlvView;
+    struct Builder;
+
+    Tlv::Status _index( const uint8_t* begin, const uint8_t* end, const uint8_t* tree_begin, int maxDepth, const Tlv::Projection* projection = nullptr );
+
+    std::vector<Entry> _entries;
+    const uint8_t* _data;
+    size_t _size;
+    int _depth;
+};
+
+/**
+ * Immutable TLV tree stored in pre-order as parallel arrays.
+ *
+ * Each node is identified by its pre-order index. Tags, value positions, parent indices and subtree
+ * end indices are kept in separate arrays, values of leaf nodes are packed into one byte buffer.
+ * Skipping a subtree is an index jump and tag searches are linear scans over the tag array.
+ * Index 0 is the root node, which has no tag for parse_all.
+ */
+class FlatTlv
+{
+public:
+    class Node;
+
+    static constexpr uint32_t npos = std::numeric_limits<uint32_t>::max();
+
+    FlatTlv();
+
+    /**
+     * Parse raw data into a flat tree, see Tlv::parse
+     * @param[in] data  - input buffer
+     * @param[in] size  - input size
+     * @param[out] s    - operation status
+     * @param[in] depth - parse sub-items recursively up to specified depth
+     * @return Parsed flat TLV tree
+     */
+    static FlatTlv parse( const uint8_t *data, const size_t size, Tlv::Status &s, int depth = Tlv::Deep );
+
+    /**
+     * Parse raw data into a flat tree of a set of TLV nodes, see Tlv::parse_all
+     * @param[in] data  - input buffer
+     * @param[in] size  - input size
+     * @param[out] s    - operation status
+     * @param[in] depth - parse sub-items recursively up to specified depth
+     * @return Parsed flat TLV tree, with an empty root tag
+     */
+    static FlatTlv parse_all( const uint8_t *data, const size_t size, Tlv::Status &s, int depth = Tlv::Deep );
+
+    /**
+     * Number of nodes, including the root node
+     */
+    size_t size() const { return _tags.size(); }
+    bool empty() const { return _tags.empty(); }
+
+    /**
+     * Root node, or an empty node if nothing was parsed
+     */
+    Node root() const;
+
+    /**
+     * Node at pre-order index
+     */
+    Node at( uint32_t index ) const;
+
+    /**
+     * Queries on the root node, see Node
+     */
+    Node find( const Tlv::Tag tag, int maxDepth = Tlv::DirectChildren ) const;
+    std::vector<Node> find_all( const Tlv::Tag tag, int maxDepth = Tlv::DirectChildren, bool findNested = false ) const;
+    void dfs( std::function<Tlv::TraversalAction(const Node&)> ) const;
+    void dfs( std::function<Tlv::TraversalAction(const Node&, int depth)> ) const;
+    std::vector<uint8_t> dump() const;
+    Tlv to_tlv() const;
+
+private:
+    friend class Node;
+    struct Builder;
+
+    std::vector<uint32_t> _tags;
+    std::vector<uint32_t> _value_offsets;   // offset into _values
+    std::vector<uint32_t> _value_lengths;
+    std::vector<uint32_t> _parents;         // npos for root
+    std::vector<uint32_t> _ends;            // index after last node of subtree
+    std::vector<uint8_t> _values;
+};
+
+/**
+ * Handle to a node of a FlatTlv. Handles must not outlive their tree.
+ */
+class FlatTlv::Node
+{
+public:
+    Node() : _tree( nullptr ), _index( npos ) {}
+
+    /**
+     * A node is empty if it references no tree node.
+     */
+    bool empty() const { return _index == npos; }
+    operator bool() const { return !empty(); }
+
+    uint32_t index() const { return _index; }
+    Tlv::Tag tag() const { return _tree->_tags[_index]; }
+    bool has_tag() const { return !tag().empty(); }
+
+    /**
+     * Node value, empty for constructed nodes that were expanded into children.
+     */
+    Tlv::ByteSpan value() const;
+    size_t value_size() const { return _tree->_value_lengths[_index]; }
+    bool has_value() const { return value_size() > 0; }
+
+    Node parent() const;
+    bool has_parent() const { return _tree->_parents[_index] != npos; }
+
+    /**
+     * Child nodes are linked by subtree end indices
+     */
+    bool has_children() const { return _tree->_ends[_index] > _index + 1; }
+    size_t num_children() const;
+    Node first_child() const;
+    Node next_sibling() const;
+
+    /**
+     * Size of tree including this node
+     */
+    size_t tree_size() const { return _tree->_ends[_index] - _index; }
+
+    /**
+     * Find one child node with matching tag. If none is found an empty node is returned.
+     */
+    Node find( const Tlv::Tag tag, int maxDepth = Tlv::DirectChildren ) const;
+
+    /**
+     * Find all child nodes with matching tag, see Tlv::find_all
+     */
+    std::vector<Node> find_all( const Tlv::Tag tag, int maxDepth = Tlv::DirectChildren, bool findNested = false ) const;
+
+    /**
+     * Depth first search tree traversal.
+     * Callback must return one of defined TraversalActions.
+     */
+    void dfs( std::function<Tlv::TraversalAction(const Node&)> ) const;
+    void dfs( std::function<Tlv::TraversalAction(const Node&, int depth)> ) const;
+
+    /**
+     * Build subtree into byte sequence (binary encoded)
+     */
+    std::vector<uint8_t> dump() const;
+
+    /**
+     * Materialize subtree as owning TLV tree
+     */
+    Tlv to_tlv() const;
+
+    bool operator==( const Node& other ) const { return _tree == other._tree && _index == other._index; }
+    bool operator!=( const Node& other ) const { return !operator==( other ); }
+
+private:
+    friend class FlatTlv;
+    Node( const FlatTlv* tree, uint32_t index ) : _tree( tree ), _index( index ) {}
+
+    const FlatTlv* _tree;
+    uint32_t _index;
+};
+
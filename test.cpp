@@ -1,6 +1,8 @@
 #include <libtlv/tlv.hpp>
 #include <CppUTest/CommandLineTestRunner.h>
 #include <CppUTest/TestHarness.h>
+#include <thread>
+#include <unordered_set>
 
 using namespace LibtlvUtil;
 
@@ -60,6 +62,56 @@ TEST(TlvMisc, Hexify)
     STRCMP_EQUAL( "0123ffeeddccbba297", s.c_str() );
 }
 
+TEST(TlvMisc, SmallVector)
+{
+    SmallVector<std::string, 2> v;
+    v.push_back( "a" );
+    v.push_back( "b" );
+    CHECK( v.is_inline() );
+    v.insert( v.begin(), "c" );
+    CHECK_FALSE( v.is_inline() );
+    CHECK( v.to_vector() == std::vector<std::string>( { "c", "a", "b" } ) );
+    v.erase( v.begin() + 1 );
+    CHECK( v.to_vector() == std::vector<std::string>( { "c", "b" } ) );
+    CHECK_THROWS( std::out_of_range, v.at( 2 ) );
+
+    // moves take over heap storage, inline elements are moved
+    const std::string* data = v.data();
+    SmallVector<std::string, 2> moved( std::move( v ) );
+    CHECK( moved.data() == data );
+    CHECK( v.empty() && v.is_inline() );
+    v.push_back( "d" );
+    moved = std::move( v );
+    CHECK( moved.to_vector() == std::vector<std::string>( { "d" } ) );
+    CHECK( moved.is_inline() );
+
+    // elements are moved between different resources
+    std::pmr::monotonic_buffer_resource arena;
+    SmallVector<std::string, 2> other( &arena );
+    other = std::move( moved );
+    CHECK( other.get_allocator().resource() == &arena );
+    CHECK( other.to_vector() == std::vector<std::string>( { "d" } ) );
+    other.resize( 3, "e" );
+    CHECK( other.to_vector() == std::vector<std::string>( { "d", "e", "e" } ) );
+
+    // front insertion and removal use free space in front of the elements
+    SmallVector<int, 2> front;
+    for( int i = 0; i < 100; i++ )
+    {
+        front.insert( front.begin(), i );
+    }
+    const int* first = front.data();
+    front.erase( front.begin() );
+    front.insert( front.begin(), 99 );
+    CHECK( front.data() == first );
+    CHECK_EQUAL( 100, front.size() );
+    CHECK_EQUAL( 99, front.front() );
+    CHECK_EQUAL( 0, front.back() );
+    front.erase( front.begin(), front.begin() + 98 );
+    front.push_back( -1 );
+    CHECK( front.to_vector() == std::vector<int>( { 1, 0, -1 } ) );
+}
+
 /*
  * TlvTag
  */
@@ -945,6 +997,130 @@ TEST(TlvBuild, TraverseDetach)
     STRCMP_EQUAL( "AA03890102", hexify( root.dump() ).c_str() );
 }
 
+TEST(TlvBuild, FindIndexed)
+{
+    Tlv root( 0xE1 );
+    for( int i = 0; i < 100; i++ )
+    {
+        root.push_back( Tlv( 0x80 + i % 10, (uint8_t)i ) );
+    }
+    CHECK( root.find( 0x83 ).value() == unhexify( "03" ) );
+    CHECK_EQUAL( 10, root.find_all( 0x89 ).size() );
+    CHECK( root.find( 0x8A ).empty() );
+    CHECK( root.find_all( 0x8A ).empty() );
+
+    // appended and removed children are kept in the index
+    root.push_back( Tlv( 0x8A, (uint8_t)100 ) );
+    CHECK( root.find( 0x8A ).value() == unhexify( "64" ) );
+    root.pop_back();
+    CHECK( root.find( 0x8A ).empty() );
+    root.pop_back();
+    CHECK_EQUAL( 9, root.find_all( 0x89 ).size() );
+
+    // other changes rebuild it
+    root.push_front( Tlv( 0x83, (uint8_t)0xFF ) );
+    CHECK( root.find( 0x83 ).value() == unhexify( "FF" ) );
+    root.front().detach();
+    root.find( 0x83 ).detach();
+    CHECK( root.find( 0x83 ).value() == unhexify( "0D" ) );
+    root.find( 0x84 ).set_tag( 0x8B );
+    CHECK( root.find( 0x8B ).value() == unhexify( "04" ) );
+    CHECK_EQUAL( 9, root.find_all( 0x84 ).size() );
+    std::reverse( root.begin(), root.end() );
+    CHECK( root.find( 0x80 ).value() == unhexify( "5A" ) );
+    CHECK_EQUAL( 10, root.remove( 0x80 ) );
+    CHECK( root.find( 0x80 ).empty() );
+    CHECK( root.find( 0x81 ).value() == unhexify( "5B" ) );
+}
+
+TEST(TlvBuild, DetachMany)
+{
+    Tlv root( 0xE1 );
+    std::vector<Tlv> nodes;
+    for( int i = 0; i < 10; i++ )
+    {
+        nodes.push_back( Tlv( 0x80 + i, (uint8_t)i ) );
+        if( i % 2 )
+        {
+            root.push_back( nodes.back() );
+        }
+        else
+        {
+            root.push_front( nodes.back() );
+        }
+    }
+    STRCMP_EQUAL( "E11E" "880108" "860106" "840104" "820102" "800100" "810101" "830103" "850105" "870107" "890109",
+                  hexify( root.dump() ).c_str() );
+
+    // first, middle and last children
+    nodes[8].detach();
+    nodes[0].detach();
+    nodes[9].detach();
+    root.begin()->detach();
+    STRCMP_EQUAL( "E112" "840104" "820102" "810101" "830103" "850105" "870107", hexify( root.dump() ).c_str() );
+    CHECK_FALSE( nodes[6].has_parent() );
+
+    // children reordered through iterators are still found
+    std::reverse( root.begin(), root.end() );
+    nodes[3].detach();
+    nodes[4].detach();
+    STRCMP_EQUAL( "E10C" "870107" "850105" "810101" "820102", hexify( root.dump() ).c_str() );
+
+    CHECK_EQUAL( 2, root.remove_if( []( const Tlv& child ) { return child.value()[0] > 4; } ) );
+    CHECK_FALSE( nodes[7].has_parent() );
+    CHECK( nodes[1].has_parent() );
+    STRCMP_EQUAL( "E106" "810101" "820102", hexify( root.dump() ).c_str() );
+    nodes[2].detach();
+    STRCMP_EQUAL( "E103" "810101", hexify( root.dump() ).c_str() );
+}
+
+TEST(TlvBuild, DetachMiddle)
+{
+    Tlv root( 0xE1 );
+    std::vector<Tlv> nodes;
+    for( int i = 0; i < 100; i++ )
+    {
+        nodes.push_back( Tlv( 0x80, (uint8_t)i ) );
+        root.push_back( nodes.back() );
+    }
+
+    // siblings behind detached children are found, also when appended children take their slots
+    for( int i = 40; i < 60; i++ )
+    {
+        nodes[i].detach();
+    }
+    for( int i = 0; i < 10; i++ )
+    {
+        nodes.push_back( Tlv( 0x81, (uint8_t)i ) );
+        root.push_back( nodes.back() );
+    }
+    nodes.push_back( Tlv( 0x82, (uint8_t)0 ) );
+    root.push_front( nodes.back() );
+    CHECK_EQUAL( 91, root.num_children() );
+
+    for( size_t i = nodes.size(); i-- > 0; )
+    {
+        if( i % 3 == 0 && nodes[i].has_parent() )
+        {
+            nodes[i].detach();
+        }
+    }
+    Tlv expected( 0xE1 );
+    expected.push_back( Tlv( 0x82, (uint8_t)0 ) );
+    for( int i = 0; i < 110; i++ )
+    {
+        if( ( i < 40 || i >= 60 ) && i % 3 != 0 )
+        {
+            expected.push_back( i < 100 ? Tlv( 0x80, (uint8_t)i ) : Tlv( 0x81, (uint8_t)( i - 100 ) ) );
+        }
+    }
+    CHECK( root.dump() == expected.dump() );
+    for( auto& child : root )
+    {
+        CHECK( child.has_parent() );
+    }
+}
+
 TEST( TlvBuild, LongLengthEncoding )
 {
     std::vector<uint8_t> data( 0xFF /*size*/, 0xF );
@@ -1148,6 +1324,208 @@ TEST(TlvBuild, AssignmentOperator)
     CHECK( node == third );
 }
 
+TEST(TlvBuild, Hash)
+{
+    auto build = []( uint8_t amount )
+    {
+        Tlv root( 0xE1 );
+        Tlv record( 0xE2 );
+        record.push_back( Tlv( 0x81, amount ) );
+        record.push_back( Tlv( 0x82, "EUR" ) );
+        root.push_back( record );
+        root.push_back( Tlv( 0x83 ) );
+        return root;
+    };
+    Tlv first = build( 0x10 );
+    Tlv second = build( 0x10 );
+
+    // separately built trees are equal and hash equal, parents are not compared
+    CHECK_EQUAL( first.hash(), second.hash() );
+    CHECK( first == second );
+    CHECK( first.front() == second.front() );
+    CHECK( first.front() == build( 0x10 ).front().clone() );
+    auto encoded = first.dump();
+    Tlv::Status s;
+    CHECK_EQUAL( first.hash(), Tlv::parse( encoded.data(), encoded.size(), s ).hash() );
+
+    // changes are seen by the ancestors
+    size_t hash = first.hash();
+    first.front().front().set_value( unhexify( "20" ) );
+    CHECK( first.hash() != hash );
+    CHECK( first != second );
+    CHECK( first == build( 0x20 ) );
+    first.back().set_tag( 0x84 );
+    CHECK( first != build( 0x20 ) );
+    first.back().set_tag( 0x83 );
+    CHECK_EQUAL( build( 0x20 ).hash(), first.hash() );
+    std::reverse( first.begin(), first.end() );
+    CHECK( first != build( 0x20 ) );
+
+    // tag, value and children are distinguished
+    CHECK( Tlv( 0x81, "A" ) != Tlv( 0x82, "A" ) );
+    CHECK( Tlv( 0x81, "A" ) != Tlv( 0x81, "B" ) );
+    CHECK( Tlv( 0xE1, Tlv( 0x81 ) ) != Tlv( 0xE1 ) );
+
+    std::unordered_set<Tlv> set;
+    for( uint8_t amount : { 1, 2, 1, 3, 2 } )
+    {
+        set.insert( build( amount ) );
+    }
+    CHECK_EQUAL( 3, set.size() );
+    CHECK_EQUAL( 1, set.count( build( 3 ) ) );
+}
+
+TEST(TlvBuild, EncodedSizeCache)
+{
+    Tlv root( 0xE1 );
+    Tlv record( 0x70 );
+    Tlv amount( 0x9F02, unhexify( "000000001000" ) );
+    record.push_back( amount );
+    record.push_back( Tlv( 0x5A, unhexify( "12345678" ) ) );
+    root.push_back( record );
+    root.push_back( Tlv( 0x9F36, (uint16_t)0x0102 ) );
+
+    STRCMP_EQUAL( "E116700F9F02060000000010005A04123456789F36020102", hexify( root.dump() ).c_str() );
+    CHECK_EQUAL( 24, root.encoded_size() );
+    CHECK_EQUAL( 17, record.encoded_size() );
+
+    // changed leaf updates all ancestors
+    amount.set_value( unhexify( "0000000020" ) );
+    CHECK_EQUAL( 23, root.encoded_size() );
+    STRCMP_EQUAL( "E115700E9F020500000000205A04123456789F36020102", hexify( root.dump() ).c_str() );
+
+    // length fields grow with the value
+    amount.value().resize( 200 );
+    CHECK_EQUAL( root.dump().size(), root.encoded_size() );
+    CHECK_EQUAL( 3 + 3 + 3 + 1 + 200 + 6 + 5, root.encoded_size() );
+
+    amount.set_tag( 0x81 );
+    CHECK_EQUAL( 3 + 3 + 2 + 1 + 200 + 6 + 5, root.encoded_size() );
+
+    record.pop_back();
+    record.front().detach();
+    CHECK_EQUAL( 9, root.encoded_size() );
+    STRCMP_EQUAL( "E10770009F36020102", hexify( root.dump() ).c_str() );
+
+    record.push_front( amount );
+    root.remove( 0x9F36 );
+    CHECK_EQUAL( root.dump().size(), root.encoded_size() );
+    CHECK_EQUAL( 0, root.find( 0x9F36 ).tag().value() );
+    CHECK_EQUAL( 1, root.num_children() );
+}
+
+TEST(TlvBuild, EncodedSizeParsed)
+{
+    const auto buf = unhexify( "BF0110DA03414243DA03444546AA04100201021101FF" );
+    Tlv::Status s;
+    auto tlv = Tlv::parse_all( buf.data(), buf.size(), s );
+    CHECK( s.ok() );
+    CHECK_EQUAL( buf.size(), tlv.encoded_size() );
+
+    tlv.find( 0x10, Tlv::Deep ).set_value( unhexify( "010203" ) );
+    STRCMP_EQUAL( "BF0111DA03414243DA03444546AA051003010203" "1101FF", hexify( tlv.dump() ).c_str() );
+
+    // formatted trees link parents as well
+    auto formatted = Tlv::parse_formatted( "BF01\n    8A 0102\n    8B 03\n", s );
+    CHECK( s.ok() );
+    CHECK_EQUAL( 10, formatted.encoded_size() );
+    formatted.find( 0x8B, Tlv::Deep ).set_value( unhexify( "0304" ) );
+    CHECK( formatted.find( 0x8B, Tlv::Deep ).has_parent() );
+    STRCMP_EQUAL( "BF01088A0201028B020304", hexify( formatted.dump() ).c_str() );
+}
+
+TEST(TlvBuild, DumpInto)
+{
+    const auto buf = unhexify( "BF0110DA03414243DA03444546AA04100201021101FF" );
+    Tlv::Status s;
+    auto tlv = Tlv::parse_all( buf.data(), buf.size(), s );
+    CHECK( s.ok() );
+
+    // caller buffer, nothing is written if it is too small
+    std::vector<uint8_t> out( buf.size(), 0xEE );
+    CHECK_EQUAL( buf.size(), tlv.dump_into( out.data(), out.size() - 1 ) );
+    CHECK( std::all_of( out.begin(), out.end(), []( uint8_t b ) { return b == 0xEE; } ) );
+    CHECK_EQUAL( buf.size(), tlv.dump_into( out.data(), out.size() ) );
+    CHECK( out == buf );
+
+    // output iterator
+    std::string str;
+    CHECK_EQUAL( buf.size(), tlv.dump_into( std::back_inserter( str ) ) );
+    CHECK( std::vector<uint8_t>( str.begin(), str.end() ) == buf );
+
+    // append to existing data
+    out = unhexify( "0102" );
+    CHECK_EQUAL( 3, tlv.children().back().dump_append( out ) );
+    CHECK_EQUAL( 19, tlv.children().front().dump_append( out ) );
+    STRCMP_EQUAL( "01021101FFBF0110DA03414243DA03444546AA0410020102", hexify( out ).c_str() );
+}
+
+TEST(TlvBuild, DumpReverse)
+{
+    const auto buf = unhexify( "450101BF850116AA0C8A04010203048B0230318C004F02ABCD4F02EF014600" );
+    Tlv::Status s;
+    auto tlv = Tlv::parse_all( buf.data(), buf.size(), s );
+    CHECK( s.ok() );
+    CHECK( tlv.dump_reverse() == buf );
+    CHECK( tlv.children()[1].dump_reverse() == tlv.children()[1].dump() );
+
+    // output grows beyond the initial buffer, long form lengths
+    Tlv root( 0xE1 );
+    for( int i = 0; i < 100; i++ )
+    {
+        root.push_back( Tlv( 0x70, Tlv( 0x9F02, std::string( i, 'x' ) ) ) );
+    }
+    CHECK( root.dump_reverse() == root.dump() );
+    CHECK( Tlv().dump_reverse().empty() );
+}
+
+TEST(TlvBuild, InlineValue)
+{
+    CHECK( Tlv( 0x9F02, (uint32_t)1000 ).value().is_inline() );
+    CHECK( Tlv( 0x5A, std::string( 16, 'x' ) ).value().is_inline() );
+    CHECK_FALSE( Tlv( 0x5A, std::string( 17, 'x' ) ).value().is_inline() );
+
+    const auto buf = unhexify( "7016" "5A021234" "9F020F000000000000000000000000000000" );
+    Tlv::Status s;
+    auto tlv = Tlv::parse( buf.data(), buf.size(), s );
+    CHECK( s.ok() );
+    CHECK( tlv.front().value().is_inline() );
+    CHECK( tlv.front().value() == unhexify( "1234" ) );
+    CHECK( Tlv::ByteSpan( tlv.back().value() ).to_vector() == tlv.back().value().to_vector() );
+
+    // growing a value moves it to the heap
+    Tlv leaf = tlv.front();
+    leaf.value().resize( 20, 0xAA );
+    CHECK_FALSE( leaf.value().is_inline() );
+    CHECK_EQUAL( 0xAA, leaf.value().back() );
+    CHECK( tlv.dump() == unhexify( "7028" "5A14" "1234AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA" "9F020F000000000000000000000000000000" ) );
+}
+
+TEST(TlvBuild, DumpGather)
+{
+    Tlv record( 0x70 );
+    record.push_back( Tlv( 0x9F02, std::string( 40, 'x' ) ) );
+    record.push_back( Tlv( 0x5A, std::string( 2, 'y' ) ) );
+    Tlv root( 0xE1, record );
+    root.push_back( Tlv( 0x4F, std::string( 50, 'z' ) ) );
+
+    // headers and the small value are merged, large values reference the tree
+    auto list = root.dump_gather();
+    CHECK_EQUAL( root.encoded_size(), list.size() );
+    CHECK( list.to_vector() == root.dump() );
+    CHECK_EQUAL( 4, list.segments().size() );
+    CHECK( list.segments()[1].data() == root.front().front().value().data() );
+    CHECK( list.segments()[3].data() == root.back().value().data() );
+
+    CHECK_EQUAL( 1, root.dump_gather( 100 ).segments().size() );
+    CHECK( root.dump_gather( 0 ).to_vector() == root.dump() );
+
+    // segments stay valid when the list is moved
+    Tlv::GatherList moved = std::move( list );
+    CHECK( moved.to_vector() == root.dump() );
+    CHECK( Tlv().dump_gather().segments().empty() );
+}
+
 /*
  * TlvParse
  */
@@ -1710,3 +2088,1264 @@ BF8501
     CHECK_EQUAL( root2.dump_formatted(), std::string(formattedStr) );
 }
 
+TEST(TlvParse, ProjectionTags)
+{
+    const auto buf = unhexify( "70159F02060000000010005A03123456A5059F360200019F3602000A5F2A020978" );
+    Tlv::Status s;
+    auto tlv = Tlv::parse_all( buf.data(), buf.size(), s, Tlv::Projection{ 0x9F02, 0x9F36 } );
+    CHECK( s.ok() );
+    CHECK_EQUAL( buf.size(), s.parsed_len() );
+    CHECK_EQUAL( 6, tlv.tree_size() );
+    STRCMP_EQUAL( "70109F0206000000001000A5059F360200019F3602000A", hexify( tlv.dump() ).c_str() );
+    CHECK( tlv.find( 0x70 ).find( 0xA5 ).find( 0x9F36 ).has_parent() );
+
+    // selected constructed nodes are parsed with their subtree
+    tlv = Tlv::parse_all( buf.data(), buf.size(), s, Tlv::Projection{ 0xA5 } );
+    CHECK( s.ok() );
+    STRCMP_EQUAL( "7007A5059F36020001", hexify( tlv.dump() ).c_str() );
+
+    tlv = Tlv::parse_all( buf.data(), buf.size(), s, Tlv::Projection() );
+    CHECK( s.ok() );
+    CHECK( tlv.empty() );
+}
+
+TEST(TlvParse, ProjectionPaths)
+{
+    // A5 has a malformed child, it is only decoded if the projection descends into it
+    const auto buf = unhexify( "70139F02060000000010005A03123456A503DF0105" );
+    Tlv::Status s;
+    Tlv::Projection projection;
+    projection.add_path( { 0x70, 0x5A } );
+
+    auto tlv = Tlv::parse( buf.data(), buf.size(), s, projection );
+    CHECK( s.ok() );
+    CHECK_EQUAL( buf.size(), s.parsed_len() );
+    CHECK_EQUAL( 0x70, tlv.tag().value() );
+    CHECK_EQUAL( 1, tlv.num_children() );
+    STRCMP_EQUAL( "70055A03123456", hexify( tlv.dump() ).c_str() );
+
+    tlv = Tlv::parse_all( buf.data(), buf.size(), s, projection );
+    CHECK( s.ok() );
+    STRCMP_EQUAL( "70055A03123456", hexify( tlv.dump() ).c_str() );
+
+    tlv = Tlv::parse_all( buf.data(), buf.size(), s, Tlv::Projection{ 0x5A } );
+    CHECK_EQUAL( Tlv::Status::UnexpectedEnd, s.code() );
+
+    // root node is kept even if the projection does not select anything
+    tlv = Tlv::parse( buf.data(), buf.size(), s, Tlv::Projection().add_path( { 0x71, 0x5A } ) );
+    CHECK( s.ok() );
+    STRCMP_EQUAL( "7000", hexify( tlv.dump() ).c_str() );
+
+    tlv = Tlv::parse( buf.data(), buf.size(), s, projection, 1 );
+    CHECK( s.ok() );
+    CHECK( tlv.dump() == buf );
+}
+
+TEST(TlvParse, ParallelParseAll)
+{
+    // records E0 { 9F02 <counter>, 5A <pan> }, with padding between some of them
+    std::vector<uint8_t> buf;
+    for( uint32_t i = 0; i < 30000; i++ )
+    {
+        const auto record = unhexify( "E00F9F02060000000000005A0412345678" );
+        buf.insert( buf.end(), record.begin(), record.end() );
+        auto counter = buf.end() - 9;
+        counter[0] = i >> 16;
+        counter[1] = i >> 8;
+        counter[2] = i;
+        if( i % 7 == 0 )
+        {
+            buf.push_back( 0x00 );
+        }
+    }
+
+    Tlv::Status s;
+    auto expected = Tlv::parse_all( buf.data(), buf.size(), s );
+    CHECK( s.ok() );
+    auto tlv = Tlv::parse_all_parallel( buf.data(), buf.size(), s, Tlv::Deep, 4 );
+    CHECK( s.ok() );
+    CHECK_EQUAL( buf.size(), s.parsed_len() );
+    CHECK_EQUAL( 30000, tlv.num_children() );
+    CHECK( tlv.dump() == expected.dump() );
+    CHECK( tlv.children().back().has_parent() );
+
+    tlv = Tlv::parse_all_parallel( buf.data(), buf.size(), s, 1, 4 );
+    CHECK( s.ok() );
+    CHECK( tlv.dump() == Tlv::parse_all( buf.data(), buf.size(), s, 1 ).dump() );
+
+    // first error in document order, as for parse_all
+    buf[buf.size() / 2] = 0xFF;
+    buf[buf.size() / 2 + 1] = 0xFF;
+    buf[buf.size() - 3] = 0x7F;
+    Tlv::Status expectedStatus;
+    Tlv::parse_all( buf.data(), buf.size(), expectedStatus );
+    CHECK_FALSE( expectedStatus.ok() );
+    tlv = Tlv::parse_all_parallel( buf.data(), buf.size(), s, Tlv::Deep, 4 );
+    CHECK_EQUAL( expectedStatus.code(), s.code() );
+    CHECK_EQUAL( expectedStatus.parsed_len(), s.parsed_len() );
+    CHECK( tlv.empty() );
+}
+
+
+TEST(TlvParse, IndefiniteLength)
+{
+    // zero bytes inside values and nested indefinite length nodes do not end the content
+    const auto buf = unhexify( "E1805A0212347080" "9F0203000000" "0000" "0000" "4F01AA" );
+    Tlv::Status s;
+    auto tlv = Tlv::parse_all( buf.data(), buf.size(), s );
+    CHECK( s.ok() );
+    CHECK_EQUAL( buf.size(), s.parsed_len() );
+    CHECK_EQUAL( 2, tlv.num_children() );
+    CHECK( tlv.dump() == unhexify( "E10C5A02123470069F0203000000" "4F01AA" ) );
+
+    auto root = Tlv::parse( buf.data(), buf.size(), s );
+    CHECK( s.ok() );
+    CHECK_EQUAL( buf.size() - 3, s.parsed_len() );
+    CHECK( root.dump() == tlv.front().dump() );
+
+    // content of unexpanded nodes excludes the end-of-contents
+    tlv = Tlv::parse_all( buf.data(), buf.size(), s, 1 );
+    CHECK( s.ok() );
+    CHECK( tlv.front().value() == unhexify( "5A0212347080" "9F0203000000" "0000" ) );
+
+    auto tape = TlvTape::index( buf.data(), buf.size(), s );
+    CHECK( s.ok() );
+    CHECK( tape.encoded( 0 ).to_vector() == std::vector<uint8_t>( buf.begin(), buf.end() - 3 ) );
+    CHECK_EQUAL( 2, TlvView::parse_all( buf.data(), buf.size(), s ).num_children() );
+}
+
+TEST(TlvParse, Passthrough)
+{
+    // non-minimal and indefinite length fields are kept for unchanged nodes
+    auto source = std::make_shared<const std::vector<uint8_t>>( unhexify( "E1810E5A0212347080" "9F0203000000" "0000" "4F01AA" ) );
+    Tlv::Status s;
+    auto tlv = Tlv::parse_all( source, s );
+    CHECK( s.ok() );
+    CHECK( tlv.dump() == *source );
+    CHECK_EQUAL( source->size(), tlv.encoded_size() );
+    CHECK( tlv.dump_reverse() == *source );
+    CHECK( tlv.dump_gather( 0 ).segments()[0].data() == source->data() );
+
+    // tree keeps the source alive
+    const std::vector<uint8_t> copy = *source;
+    source.reset();
+    CHECK( tlv.dump() == copy );
+
+    // changed node is encoded, unchanged sibling is copied
+    tlv.back().set_value( unhexify( "BBCC" ) );
+    CHECK( tlv.dump() == unhexify( "E1810E5A0212347080" "9F0203000000" "0000" "4F02BBCC" ) );
+
+    // change below the indefinite length node re-encodes its ancestors only
+    tlv.front().back().front().value()[0] = 0x01;
+    CHECK( tlv.dump() == unhexify( "E10C5A02123470069F0203010000" "4F02BBCC" ) );
+    CHECK_EQUAL( tlv.dump().size(), tlv.encoded_size() );
+    CHECK( tlv.dump_reverse() == tlv.dump() );
+
+    tlv.front().front().set_tag( 0x5B );
+    CHECK( tlv.dump() == unhexify( "E10C5B02123470069F0203010000" "4F02BBCC" ) );
+
+    // single node and structure changes
+    source = std::make_shared<const std::vector<uint8_t>>( copy );
+    auto root = Tlv::parse( source, s );
+    CHECK( s.ok() );
+    CHECK_EQUAL( 17, s.parsed_len() );
+    CHECK( root.dump() == std::vector<uint8_t>( copy.begin(), copy.begin() + 17 ) );
+    root.front().detach();
+    CHECK( root.dump() == unhexify( "E10A7080" "9F0203000000" "0000" ) );
+
+    // detached and cloned nodes keep the input after their tree is released
+    auto detached = Tlv::parse( source, s ).back();
+    detached.detach();
+    auto cloned = Tlv::parse( source, s ).clone();
+    source.reset();
+    root = Tlv();
+    CHECK( detached.dump() == unhexify( "7080" "9F0203000000" "0000" ) );
+    CHECK( cloned.dump() == std::vector<uint8_t>( copy.begin(), copy.begin() + 17 ) );
+    CHECK( cloned.dump_reverse() == cloned.dump() );
+
+    // children reordered through iterators
+    source = std::make_shared<const std::vector<uint8_t>>( unhexify( "E106810101820102" ) );
+    auto reordered = Tlv::parse( source, s );
+    std::iter_swap( reordered.begin(), reordered.begin() + 1 );
+    CHECK( reordered.dump() == unhexify( "E106820102810101" ) );
+    CHECK( Tlv::parse_all( Tlv::Source(), s ).empty() );
+    CHECK_EQUAL( Tlv::Status::BadArgument, s.code() );
+}
+
+TEST(TlvParse, IndefiniteLengthErrors)
+{
+    Tlv::Status s;
+    auto buf = unhexify( "5A80AA0000" );
+    Tlv::parse_all( buf.data(), buf.size(), s );
+    CHECK_EQUAL( Tlv::Status::BadLength, s.code() );
+
+    // missing end-of-contents of the outer and of a nested node
+    buf = unhexify( "E1805A021234" );
+    Tlv::parse_all( buf.data(), buf.size(), s );
+    CHECK_EQUAL( Tlv::Status::UnexpectedEnd, s.code() );
+    buf = unhexify( "E18070805A01AA0000" );
+    Tlv::parse_all( buf.data(), buf.size(), s );
+    CHECK_EQUAL( Tlv::Status::UnexpectedEnd, s.code() );
+
+    // length field of a nested node too large
+    buf = unhexify( "E1805A8500000000010000" );
+    Tlv::parse_all( buf.data(), buf.size(), s );
+    CHECK_EQUAL( Tlv::Status::BadLength, s.code() );
+}
+
+/*
+ * TlvValidate
+ */
+
+TEST_GROUP(TlvValidate)
+{};
+
+TEST(TlvValidate, SameAsParse)
+{
+    const char* inputs[] = {
+        "",
+        "0000",
+        "450101BF85010EAA068A047465737493040ABBCCDD5F41020345",
+        "BF0110DA03414243DA03444546AA04100201021101FF",
+        "100101AA079F1002414210019F110131",      // child exceeds parent
+        "BF100AAA058B034142431001008C01",        // value exceeds input
+        "9F",                                    // incomplete tag
+        "9F8080808001",                          // tag too long
+        "1085000000000100",                      // length too large
+        "AA0410",                                // missing length of child
+    };
+
+    for( auto input : inputs )
+    {
+        const auto buf = unhexify( input );
+        for( int depth : { 1, 2, (int)Tlv::Deep } )
+        {
+            Tlv::Status expected;
+            Tlv::parse_all( buf.data(), buf.size(), expected, depth );
+            Tlv::Status s;
+            CHECK_EQUAL( expected.ok(), Tlv::validate( buf.data(), buf.size(), s, depth ) );
+            CHECK_EQUAL( expected.code(), s.code() );
+            CHECK_EQUAL( expected.parsed_len(), s.parsed_len() );
+        }
+    }
+
+    Tlv::Status s;
+    CHECK_FALSE( Tlv::validate( nullptr, 0, s, 0 ) );
+    CHECK_EQUAL( Tlv::Status::BadArgument, s.code() );
+}
+
+TEST(TlvValidate, DeepNesting)
+{
+    // 50 nested constructed nodes with a primitive leaf
+    std::vector<uint8_t> buf = unhexify( "0101FF" );
+    for( int i = 0; i < 50; i++ )
+    {
+        const uint8_t header[] = { 0x30, (uint8_t)buf.size() };
+        buf.insert( buf.begin(), header, header + 2 );
+    }
+    Tlv::Status s;
+    CHECK( Tlv::validate( buf.data(), buf.size(), s ) );
+    CHECK_EQUAL( buf.size(), s.parsed_len() );
+
+    buf[buf.size() - 2] = 0x02;
+    CHECK_FALSE( Tlv::validate( buf.data(), buf.size(), s ) );
+    CHECK_EQUAL( Tlv::Status::UnexpectedEnd, s.code() );
+}
+
+/*
+ * TlvPatch
+ */
+
+TEST_GROUP(TlvPatch)
+{};
+
+TEST(TlvPatch, SameSize)
+{
+    auto buf = unhexify( "4F01AA" "E10E5A0212347080" "9F0203000000" "0000" "9F0201FF" );
+    const std::vector<Tlv::Tag> path{ 0xE1, 0x70, 0x9F02 };
+    auto s = Tlv::patch_value( buf.data(), buf.size(), path, unhexify( "000150" ) );
+    CHECK( s.ok() );
+    CHECK_EQUAL( 14, s.parsed_len() );
+    CHECK( buf == unhexify( "4F01AA" "E10E5A0212347080" "9F0203000150" "0000" "9F0201FF" ) );
+
+    // first match on each level, primitive nodes are not descended into
+    s = Tlv::patch_value( buf.data(), buf.size(), { 0x9F02 }, unhexify( "01" ) );
+    CHECK( s.ok() );
+    CHECK( buf == unhexify( "4F01AA" "E10E5A0212347080" "9F0203000150" "0000" "9F020101" ) );
+    CHECK_EQUAL( Tlv::Status::BadArgument, Tlv::patch_value( buf.data(), buf.size(), { 0x4F, 0x5A }, unhexify( "01" ) ).code() );
+    CHECK_EQUAL( Tlv::Status::BadArgument, Tlv::patch_value( buf.data(), buf.size(), { 0xE1, 0x4F }, unhexify( "01" ) ).code() );
+    CHECK_EQUAL( Tlv::Status::BadArgument, Tlv::patch_value( buf.data(), buf.size(), {}, unhexify( "01" ) ).code() );
+    CHECK_EQUAL( Tlv::Status::BadLength, Tlv::patch_value( buf.data(), buf.size(), { 0x4F }, unhexify( "0102" ) ).code() );
+
+    // malformed data before the node
+    auto bad = unhexify( "4F05AA" );
+    CHECK_EQUAL( Tlv::Status::UnexpectedEnd, Tlv::patch_value( bad.data(), bad.size(), { 0x5A }, unhexify( "01" ) ).code() );
+}
+
+TEST(TlvPatch, Resize)
+{
+    Tlv record( 0x70 );
+    record.push_back( Tlv( 0x5A, unhexify( "1234" ) ) );
+    record.push_back( Tlv( 0x9F02, std::vector<uint8_t>( 120, 0x01 ) ) );
+    record.push_back( Tlv( 0x4F, unhexify( "AA" ) ) );
+    Tlv tree;
+    tree.push_back( Tlv( 0x8A, unhexify( "01" ) ) );
+    tree.push_back( Tlv( 0xE1, record ) );
+    tree.push_back( Tlv( 0x8B, unhexify( "02" ) ) );
+    auto buf = tree.dump();
+    const std::vector<Tlv::Tag> path{ 0xE1, 0x70, 0x9F02 };
+    Tlv amount = tree.children()[1].front().children()[1];
+
+    // length fields grow to long form
+    const std::vector<uint8_t> large( 300, 0x02 );
+    auto s = Tlv::patch_value( buf, path, large );
+    CHECK( s.ok() );
+    amount.set_value( large );
+    CHECK( buf == tree.dump() );
+    CHECK_EQUAL( 20, s.parsed_len() );
+    CHECK_EQUAL( 0x02, buf[s.parsed_len()] );
+
+    // length fields keep their size when shrinking
+    const auto small = unhexify( "0304" );
+    s = Tlv::patch_value( buf, path, small );
+    CHECK( s.ok() );
+    CHECK( buf == unhexify( "8A0101" "E1820012" "7082000E" "5A021234" "9F028200020304" "4F01AA" "8B0102" ) );
+    CHECK_EQUAL( 20, s.parsed_len() );
+
+    Tlv::Status ps;
+    amount.set_value( small );
+    CHECK( Tlv::parse_all( buf.data(), buf.size(), ps ).dump() == tree.dump() );
+    CHECK( ps.ok() );
+
+    // indefinite length ancestor needs no rewrite
+    buf = unhexify( "E1087080" "9F0201AA" "0000" "4F01BB" );
+    s = Tlv::patch_value( buf, path, unhexify( "AABBCC" ) );
+    CHECK( s.ok() );
+    CHECK( buf == unhexify( "E10A7080" "9F0203AABBCC" "0000" "4F01BB" ) );
+}
+
+/*
+ * TlvView
+ */
+
+TEST_GROUP(TlvView)
+{};
+
+TEST(TlvView, ParseAll)
+{
+    const auto buf = unhexify( "450101BF85010EAA068A047465737493040ABBCCDD5F41020345" );
+    Tlv::Status s;
+    auto view = TlvView::parse_all( buf.data(), buf.size(), s );
+    CHECK( s.ok() );
+    CHECK_EQUAL( buf.size(), s.parsed_len() );
+    CHECK_FALSE( view.has_tag() );
+    CHECK_EQUAL( 3, view.num_children() );
+
+    auto it = view.children().begin();
+    CHECK_EQUAL( 0x45, it->tag().value() );
+    CHECK_EQUAL( 1, it->value_size() );
+    CHECK_EQUAL( 0x01, it->value()[0] );
+    CHECK_EQUAL( 2, it->offset() );
+
+    ++it;
+    CHECK_EQUAL( 0xBF8501, it->tag().value() );
+    CHECK_FALSE( it->has_value() );
+    CHECK_EQUAL( 2, it->num_children() );
+
+    // values reference the input buffer
+    auto _8A = it->find( 0xAA ).find( 0x8A );
+    CHECK_EQUAL( 0x8A, _8A.tag().value() );
+    CHECK( _8A.value().data() == buf.data() + 11 );
+    STRCMP_EQUAL( "test", std::string( _8A.value().begin(), _8A.value().end() ).c_str() );
+
+    ++it;
+    CHECK_EQUAL( 0x5F41, it->tag().value() );
+    ++it;
+    CHECK( it == view.children().end() );
+}
+
+TEST(TlvView, ParseDepth)
+{
+    const auto buf = unhexify( "BF100AAA058B034142431001008C01FF" );
+    Tlv::Status s;
+    auto view = TlvView::parse( buf.data(), buf.size(), s, 2 );
+    CHECK( s.ok() );
+    CHECK_EQUAL( 0xBF10, view.tag().value() );
+    CHECK_EQUAL( 2, view.num_children() );
+
+    // AA is beyond depth, value is not expanded
+    auto _AA = view.find( 0xAA );
+    CHECK_FALSE( _AA.has_children() );
+    CHECK_EQUAL( 5, _AA.value_size() );
+    CHECK_FALSE( view.find( 0x8C ) );
+}
+
+TEST(TlvView, ParseErrors)
+{
+    const auto buf = unhexify( "100101AA079F1002414210019F110131" );
+    Tlv::Status s;
+    auto view = TlvView::parse_all( buf.data(), buf.size(), s );
+    CHECK_FALSE( s.ok() );
+    CHECK_EQUAL( Tlv::Status::UnexpectedEnd, s.code() );
+    CHECK( view.empty() );
+
+    view = TlvView::parse( buf.data(), buf.size(), s, 0 );
+    CHECK_EQUAL( Tlv::Status::BadArgument, s.code() );
+}
+
+TEST(TlvView, ToTlv)
+{
+    const auto buf = unhexify( "0000BF0110DA03414243DA03444546AA04100201021101FF" );
+    Tlv::Status s;
+    auto view = TlvView::parse_all( buf.data(), buf.size(), s );
+    CHECK( s.ok() );
+    auto tlv = Tlv::parse_all( buf.data(), buf.size(), s );
+    CHECK( s.ok() );
+
+    auto materialized = view.to_tlv();
+    CHECK_EQUAL( tlv.tree_size(), materialized.tree_size() );
+    CHECK( tlv.dump() == materialized.dump() );
+    CHECK( tlv.dump_formatted() == materialized.dump_formatted() );
+
+    // subtree
+    auto subtree = view.children().begin()->to_tlv();
+    CHECK_EQUAL( 0xBF01, subtree.tag().value() );
+    STRCMP_EQUAL( "BF0110DA03414243DA03444546AA0410020102", hexify( subtree.dump() ).c_str() );
+}
+
+/*
+ * TlvTape
+ */
+
+TEST_GROUP(TlvTape)
+{};
+
+TEST(TlvTape, Index)
+{
+    const auto buf = unhexify( "450101BF85010EAA068A047465737493040ABBCCDD5F41020345" );
+    Tlv::Status s;
+    auto tape = TlvTape::index( buf.data(), buf.size(), s );
+    CHECK( s.ok() );
+    CHECK_EQUAL( buf.size(), s.parsed_len() );
+    CHECK_EQUAL( 6, tape.size() );
+
+    const uint32_t tags[] = { 0x45, 0xBF8501, 0xAA, 0x8A, 0x93, 0x5F41 };
+    const size_t headers[] = { 0, 3, 7, 9, 15, 21 };
+    const size_t values[] = { 2, 7, 9, 11, 17, 24 };
+    const uint32_t lengths[] = { 1, 14, 6, 4, 4, 2 };
+    const uint32_t depths[] = { 1, 1, 2, 3, 2, 1 };
+    const uint32_t ends[] = { 1, 5, 4, 4, 5, 6 };
+    for( uint32_t i = 0; i < tape.size(); i++ )
+    {
+        CHECK_EQUAL( tags[i], tape[i].tag.value() );
+        CHECK_EQUAL( headers[i], tape[i].header_offset );
+        CHECK_EQUAL( values[i], tape[i].value_offset );
+        CHECK_EQUAL( lengths[i], tape[i].length );
+        CHECK_EQUAL( depths[i], tape[i].depth );
+        CHECK_EQUAL( ends[i], tape[i].end );
+    }
+
+    CHECK( tape.expanded( 1 ) );
+    CHECK_FALSE( tape.expanded( 3 ) );
+    CHECK( tape.value( 1 ).empty() );
+    CHECK( tape.value( 3 ).data() == buf.data() + 11 );
+    STRCMP_EQUAL( "8A0474657374", hexify( tape.encoded( 3 ).to_vector() ).c_str() );
+}
+
+TEST(TlvTape, Queries)
+{
+    const auto buf = unhexify( "0000BF0110DA03414243DA03444546AA04100201021101FF" );
+    Tlv::Status s;
+    auto tape = TlvTape::index( buf.data(), buf.size(), s );
+    CHECK( s.ok() );
+    CHECK_EQUAL( 6, tape.size() );
+
+    CHECK_EQUAL( 1, tape.find( 0xDA ) );
+    CHECK_EQUAL( TlvTape::npos, tape.find( 0xDA, Tlv::DirectChildren ) );
+    CHECK_EQUAL( 5, tape.find( 0x11, Tlv::DirectChildren ) );
+    CHECK_EQUAL( 4, tape.find( 0x10, 3 ) );
+    CHECK_EQUAL( TlvTape::npos, tape.find( 0x10, 2 ) );
+    CHECK( tape.find_all( 0xDA ) == std::vector<uint32_t>( { 1, 2 } ) );
+    CHECK( tape.find_all( 0xDA, 1 ).empty() );
+    CHECK( tape.find_all( 0xBF01 ) == std::vector<uint32_t>( { 0 } ) );
+
+    // views look up children in the tape
+    auto view = tape.view();
+    CHECK_FALSE( view.has_tag() );
+    CHECK_EQUAL( 2, view.num_children() );
+    auto _AA = view.find( 0xBF01 ).find( 0xAA );
+    CHECK_EQUAL( 1, _AA.num_children() );
+    CHECK( _AA.find( 0x10 ).value().data() == buf.data() + 19 );
+    CHECK_EQUAL( 0xDA, tape.view( 2 ).tag().value() );
+    CHECK_EQUAL( 12, tape.view( 2 ).offset() );
+
+    auto tlv = Tlv::parse_all( buf.data(), buf.size(), s );
+    CHECK( tape.to_tlv().dump() == tlv.dump() );
+    CHECK( tape.to_tlv().dump_formatted() == tlv.dump_formatted() );
+    STRCMP_EQUAL( "BF0110DA03414243DA03444546AA0410020102", hexify( tape.to_tlv( 0 ).dump() ).c_str() );
+}
+
+TEST(TlvTape, IndexDepth)
+{
+    const auto buf = unhexify( "BF100AAA058B034142431001008C01FF" );
+    Tlv::Status s;
+    auto tape = TlvTape::index( buf.data(), buf.size(), s, 2 );
+    CHECK( s.ok() );
+    CHECK_EQUAL( 4, tape.size() );
+    CHECK( tape.expanded( 0 ) );
+    CHECK_FALSE( tape.expanded( 1 ) );
+    CHECK_EQUAL( 5, tape.value( 1 ).size() );
+    CHECK_EQUAL( TlvTape::npos, tape.find( 0x8B ) );
+    CHECK_FALSE( tape.view( 1 ).has_children() );
+    CHECK( tape.to_tlv().dump() == Tlv::parse_all( buf.data(), buf.size(), s, 2 ).dump() );
+
+    tape = TlvTape::index( buf.data(), buf.size() - 1, s );
+    CHECK_EQUAL( Tlv::Status::UnexpectedEnd, s.code() );
+    CHECK( tape.empty() );
+    tape = TlvTape::index( buf.data(), buf.size(), s, 0 );
+    CHECK_EQUAL( Tlv::Status::BadArgument, s.code() );
+}
+
+/*
+ * TlvStreamParse
+ */
+
+TEST_GROUP(TlvStreamParse)
+{};
+
+TEST(TlvStreamParse, Chunks)
+{
+    const auto buf = unhexify( "450101BF85010EAA068A047465737493040ABBCCDD00005F4102034510810101" );
+    Tlv::Status s;
+    auto expected = Tlv::parse_all( buf.data(), buf.size(), s );
+    CHECK( s.ok() );
+
+    for( size_t chunkSize = 1; chunkSize <= buf.size(); chunkSize++ )
+    {
+        std::vector<Tlv> records;
+        Tlv::StreamParser parser( [&]( Tlv& record ) { records.push_back( record ); } );
+
+        for( size_t pos = 0; pos < buf.size(); pos += chunkSize )
+        {
+            s = parser.feed( buf.data() + pos, std::min( chunkSize, buf.size() - pos ) );
+            CHECK( s.ok() );
+        }
+        CHECK_FALSE( parser.pending() );
+        CHECK_EQUAL( buf.size(), s.parsed_len() );
+
+        CHECK_EQUAL( expected.num_children(), records.size() );
+        for( size_t i = 0; i < records.size(); i++ )
+        {
+            CHECK( expected.children()[i].dump() == records[i].dump() );
+            CHECK_FALSE( records[i].has_parent() );
+        }
+    }
+}
+
+TEST(TlvStreamParse, IndefiniteLength)
+{
+    const auto buf = unhexify( "E1805A0212347080" "9F0203000000" "0000" "0000" "4F01AA" "7080" "0000" );
+    Tlv::Status s;
+    auto expected = Tlv::parse_all( buf.data(), buf.size(), s );
+    CHECK( s.ok() );
+
+    for( size_t chunkSize = 1; chunkSize <= buf.size(); chunkSize++ )
+    {
+        std::vector<Tlv> records;
+        Tlv::StreamParser parser( [&]( Tlv& record ) { records.push_back( record ); } );
+
+        for( size_t pos = 0; pos < buf.size(); pos += chunkSize )
+        {
+            s = parser.feed( buf.data() + pos, std::min( chunkSize, buf.size() - pos ) );
+            CHECK( s.ok() );
+        }
+        CHECK_FALSE( parser.pending() );
+        CHECK_EQUAL( buf.size(), s.parsed_len() );
+
+        CHECK_EQUAL( 3, records.size() );
+        for( size_t i = 0; i < records.size(); i++ )
+        {
+            CHECK( expected.children()[i].dump() == records[i].dump() );
+        }
+    }
+
+    // buffered content counts toward the maximum record size
+    Tlv::StreamParser limited( []( Tlv& ) {}, Tlv::Deep, 8 );
+    s = limited.feed( buf.data(), 2 );
+    CHECK( s.ok() );
+    s = limited.feed( buf.data() + 2, buf.size() - 2 );
+    CHECK_EQUAL( Tlv::Status::BadLength, s.code() );
+}
+
+TEST(TlvStreamParse, Pending)
+{
+    const auto buf = unhexify( "9F01021234" );
+    size_t count = 0;
+    Tlv::StreamParser parser( [&]( Tlv& record ) {
+        CHECK_EQUAL( 0x9F01, record.tag().value() );
+        CHECK_EQUAL( 0x1234, record.uint16() );
+        count++;
+    } );
+
+    CHECK( parser.feed( buf.data(), 3 ).ok() );
+    CHECK( parser.pending() );
+    CHECK_EQUAL( 0, count );
+    CHECK( parser.feed( buf.data() + 3, 2 ).ok() );
+    CHECK_FALSE( parser.pending() );
+    CHECK_EQUAL( 1, count );
+}
+
+TEST(TlvStreamParse, MaxRecordSize)
+{
+    // record of 12 bytes split into chunks, the buffered value is counted once
+    const auto buf = unhexify( "5A0A00112233445566778899" );
+    size_t count = 0;
+    Tlv::StreamParser parser( [&]( Tlv& record ) {
+        CHECK( record.dump() == buf );
+        count++;
+    }, Tlv::Deep, 16 );
+
+    CHECK( parser.feed( buf.data(), 7 ).ok() );
+    CHECK( parser.pending() );
+    CHECK( parser.feed( buf.data() + 7, 5 ).ok() );
+    CHECK_EQUAL( 1, count );
+}
+
+TEST(TlvStreamParse, Errors)
+{
+    Tlv::StreamParser parser( []( Tlv& ) {}, Tlv::Deep, 16 );
+
+    // length too large
+    auto buf = unhexify( "1285" );
+    auto s = parser.feed( buf.data(), buf.size() );
+    CHECK_EQUAL( Tlv::Status::BadLength, s.code() );
+    // errors are sticky until reset
+    buf = unhexify( "100100" );
+    CHECK_EQUAL( Tlv::Status::BadLength, parser.feed( buf.data(), buf.size() ).code() );
+    parser.reset();
+    CHECK( parser.feed( buf.data(), buf.size() ).ok() );
+
+    // record exceeds maximum size
+    buf = unhexify( "1011" );
+    CHECK_EQUAL( Tlv::Status::BadLength, parser.feed( buf.data(), buf.size() ).code() );
+
+    // invalid nested data
+    parser.reset();
+    buf = unhexify( "1001FFAA039F1002" );
+    s = parser.feed( buf.data(), buf.size() );
+    CHECK_EQUAL( Tlv::Status::UnexpectedEnd, s.code() );
+}
+
+/*
+ * TlvWriter
+ */
+
+TEST_GROUP(TlvWriter)
+{};
+
+namespace
+{
+    // E1 { 70 { 9F02 (300 bytes), 5A }, 70 {} }, 4F
+    void write_records( Tlv::Writer& writer )
+    {
+        const std::vector<uint8_t> amount( 300, 0x01 );
+        const auto pan = unhexify( "1234" );
+        CHECK( writer.begin_constructed( 0xE1 ).ok() );
+        CHECK( writer.begin_constructed( 0x70 ).ok() );
+        CHECK( writer.primitive( 0x9F02, amount ).ok() );
+        CHECK( writer.primitive( 0x5A, pan ).ok() );
+        CHECK( writer.end_constructed().ok() );
+        CHECK( writer.begin_constructed( 0x70 ).ok() );
+        CHECK_EQUAL( 2, writer.depth() );
+        CHECK( writer.end_constructed().ok() );
+        CHECK( writer.end_constructed().ok() );
+        CHECK( writer.primitive( 0x4F, pan ).ok() );
+        CHECK( writer.finish().ok() );
+    }
+
+    Tlv build_records()
+    {
+        Tlv record( 0x70 );
+        record.push_back( Tlv( 0x9F02, std::vector<uint8_t>( 300, 0x01 ) ) );
+        record.push_back( Tlv( 0x5A, unhexify( "1234" ) ) );
+        Tlv root;
+        root.push_back( Tlv( 0xE1, record ) );
+        root.back().push_back( Tlv( 0x70 ) );
+        root.push_back( Tlv( 0x4F, unhexify( "1234" ) ) );
+        return root;
+    }
+}
+
+TEST(TlvWriter, Compact)
+{
+    std::vector<uint8_t> out = unhexify( "AA" );
+    Tlv::Writer writer( out );
+    write_records( writer );
+    auto expected = build_records().dump();
+    expected.insert( expected.begin(), 0xAA );
+    CHECK( out == expected );
+}
+
+TEST(TlvWriter, Reserved)
+{
+    std::vector<uint8_t> out;
+    Tlv::Writer writer( out, Tlv::Writer::Reserved );
+    write_records( writer );
+    CHECK( out.size() > build_records().dump().size() );
+    CHECK_EQUAL( 0xE1, out[0] );
+    CHECK_EQUAL( 0x84, out[1] );
+
+    // reserved length fields are valid long form
+    Tlv::Status s;
+    auto tlv = Tlv::parse_all( out.data(), out.size(), s );
+    CHECK( s.ok() );
+    CHECK_EQUAL( out.size(), s.parsed_len() );
+    CHECK( tlv.dump() == build_records().dump() );
+}
+
+TEST(TlvWriter, File)
+{
+    std::FILE* file = std::tmpfile();
+    CHECK( file != nullptr );
+    Tlv::Writer writer( file );
+    write_records( writer );
+
+    std::vector<uint8_t> out( std::ftell( file ) );
+    std::rewind( file );
+    CHECK_EQUAL( out.size(), std::fread( out.data(), 1, out.size(), file ) );
+    std::fclose( file );
+
+    Tlv::Status s;
+    auto tlv = Tlv::parse_all( out.data(), out.size(), s );
+    CHECK( s.ok() );
+    CHECK( tlv.dump() == build_records().dump() );
+}
+
+TEST(TlvWriter, Indefinite)
+{
+    std::vector<uint8_t> out;
+    Tlv::Writer writer( out, Tlv::Writer::Indefinite );
+    write_records( writer );
+    CHECK( out[0] == 0xE1 && out[1] == 0x80 && out[2] == 0x70 && out[3] == 0x80 );
+
+    Tlv::Status s;
+    auto tlv = Tlv::parse_all( out.data(), out.size(), s );
+    CHECK( s.ok() );
+    CHECK_EQUAL( out.size(), s.parsed_len() );
+    CHECK( tlv.dump() == build_records().dump() );
+}
+
+TEST(TlvWriter, Errors)
+{
+    std::vector<uint8_t> out;
+    Tlv::Writer writer( out );
+    CHECK( writer.begin_constructed( 0x70 ).ok() );
+    CHECK_EQUAL( Tlv::Status::BadArgument, writer.finish().code() );
+    CHECK( writer.end_constructed().ok() );
+    CHECK_EQUAL( 2, writer.finish().parsed_len() );
+
+    // errors are sticky
+    CHECK_EQUAL( Tlv::Status::BadArgument, writer.end_constructed().code() );
+    CHECK_EQUAL( Tlv::Status::BadArgument, writer.primitive( 0x5A, out ).code() );
+    CHECK( out == unhexify( "7000" ) );
+
+    Tlv::Writer untagged( out );
+    CHECK_EQUAL( Tlv::Status::BadTag, untagged.primitive( Tlv::Tag(), out ).code() );
+}
+
+/*
+ * TlvScan
+ */
+
+TEST_GROUP(TlvScan)
+{};
+
+namespace
+{
+    // records scan events in formatted notation
+    struct RecordingHandler : public Tlv::ScanHandler
+    {
+        std::string events;
+        Tlv::Tag pruneTag;
+        Tlv::Tag breakTag;
+
+        Tlv::TraversalAction on_begin_constructed( const Tlv::Tag tag, size_t offset, size_t len ) override
+        {
+            events += "<" + tag.to_hex_string() + "@" + std::to_string( offset ) + ":" + std::to_string( len );
+            if( tag == pruneTag )
+                return Tlv::Prune;
+            return tag == breakTag ? Tlv::Break : Tlv::Continue;
+        }
+
+        Tlv::TraversalAction on_primitive( const Tlv::Tag tag, Tlv::ByteSpan value ) override
+        {
+            events += " " + tag.to_hex_string() + "=" + hexify( value.to_vector() );
+            return tag == breakTag ? Tlv::Break : Tlv::Continue;
+        }
+
+        void on_end_constructed( const Tlv::Tag tag ) override
+        {
+            events += " " + tag.to_hex_string() + ">";
+        }
+    };
+}
+
+TEST(TlvScan, Events)
+{
+    const auto buf = unhexify( "450101BF85010EAA068A047465737493040ABBCCDD5F41020345" );
+    RecordingHandler handler;
+    auto s = Tlv::scan( buf.data(), buf.size(), handler );
+    CHECK( s.ok() );
+    CHECK_EQUAL( buf.size(), s.parsed_len() );
+    STRCMP_EQUAL( " 45=01<BF8501@7:14<AA@9:6 8A=74657374 AA> 93=0ABBCCDD BF8501> 5F41=0345", handler.events.c_str() );
+
+    // constructed nodes beyond depth are reported as primitive
+    handler.events.clear();
+    s = Tlv::scan( buf.data(), buf.size(), handler, 2 );
+    CHECK( s.ok() );
+    STRCMP_EQUAL( " 45=01<BF8501@7:14 AA=8A0474657374 93=0ABBCCDD BF8501> 5F41=0345", handler.events.c_str() );
+}
+
+TEST(TlvScan, PruneBreak)
+{
+    const auto buf = unhexify( "450101BF85010EAA068A047465737493040ABBCCDD5F41020345" );
+    RecordingHandler handler;
+    handler.pruneTag = 0xAA;
+    auto s = Tlv::scan( buf.data(), buf.size(), handler );
+    CHECK( s.ok() );
+    STRCMP_EQUAL( " 45=01<BF8501@7:14<AA@9:6 93=0ABBCCDD BF8501> 5F41=0345", handler.events.c_str() );
+
+    handler.events.clear();
+    handler.breakTag = 0x93;
+    s = Tlv::scan( buf.data(), buf.size(), handler );
+    CHECK( s.ok() );
+    CHECK_EQUAL( 21, s.parsed_len() );
+    STRCMP_EQUAL( " 45=01<BF8501@7:14<AA@9:6 93=0ABBCCDD", handler.events.c_str() );
+}
+
+TEST(TlvScan, Errors)
+{
+    const auto buf = unhexify( "100101AA079F1002414210019F110131" );
+    RecordingHandler handler;
+    auto s = Tlv::scan( buf.data(), buf.size(), handler );
+    CHECK_EQUAL( Tlv::Status::UnexpectedEnd, s.code() );
+    STRCMP_EQUAL( " 10=01<AA@5:7 9F10=4142", handler.events.c_str() );
+}
+
+/*
+ * TlvArena
+ */
+
+TEST_GROUP(TlvArena)
+{};
+
+namespace
+{
+    // memory resource that counts allocations passed to upstream resource
+    class CountingResource : public std::pmr::memory_resource
+    {
+    public:
+        size_t allocations = 0;
+        size_t deallocations = 0;
+
+    private:
+        void* do_allocate( size_t bytes, size_t alignment ) override
+        {
+            allocations++;
+            return std::pmr::new_delete_resource()->allocate( bytes, alignment );
+        }
+        void do_deallocate( void* p, size_t bytes, size_t alignment ) override
+        {
+            deallocations++;
+            std::pmr::new_delete_resource()->deallocate( p, bytes, alignment );
+        }
+        bool do_is_equal( const std::pmr::memory_resource& other ) const noexcept override
+        {
+            return this == &other;
+        }
+    };
+}
+
+TEST(TlvArena, ParseIntoArena)
+{
+    const auto buf = unhexify( "450101BF85010EAA068A047465737493040ABBCCDD5F41020345" );
+    CountingResource upstream;
+    {
+        std::pmr::monotonic_buffer_resource arena( &upstream );
+        Tlv::Status s;
+        auto tlv = Tlv::parse_all( buf.data(), buf.size(), s, Tlv::Deep, &arena );
+        CHECK( s.ok() );
+        CHECK_EQUAL( 7, tlv.tree_size() );
+        CHECK( tlv.dump() == buf );
+        CHECK( tlv.find( 0x8A, Tlv::Deep ).value().get_allocator().resource() == &arena );
+        CHECK( tlv.find( 0xAA, Tlv::Deep ).children().get_allocator().resource() == &arena );
+
+        // tree is allocated in few chunks from upstream and released at once
+        CHECK( upstream.allocations > 0 );
+        CHECK( upstream.allocations < 4 );
+        CHECK_EQUAL( 0, upstream.deallocations );
+    }
+    CHECK_EQUAL( upstream.allocations, upstream.deallocations );
+}
+
+TEST(TlvArena, InlineChildren)
+{
+    // nested records with few children allocate only their nodes
+    const auto buf = unhexify( "E10F" "7008" "5A021234" "9F020100" "7003" "5A0111" );
+    CountingResource resource;
+    Tlv::Status s;
+    auto tlv = Tlv::parse( buf.data(), buf.size(), s, Tlv::Deep, &resource );
+    CHECK( s.ok() );
+    CHECK( tlv.dump() == buf );
+    CHECK_EQUAL( 6, resource.allocations );
+    CHECK( tlv.children().is_inline() );
+
+    // children beyond the inline slots move to the resource
+    for( int i = 0; i < 4; i++ )
+    {
+        tlv.push_back( Tlv( 0x5A, (uint8_t)i ) );
+    }
+    CHECK_FALSE( tlv.children().is_inline() );
+    CHECK_EQUAL( 6 + 1, resource.allocations );
+    CHECK_EQUAL( 6, tlv.num_children() );
+    CHECK( tlv.children()[5].value() == unhexify( "03" ) );
+
+    tlv.reset();
+    CHECK_EQUAL( resource.allocations, resource.deallocations );
+}
+
+TEST(TlvArena, TagIndex)
+{
+    // the tag index of a wide node and its lists are allocated from the resource of the node
+    Tlv wide( 0xE1 );
+    for( int i = 0; i < 40; i++ )
+    {
+        wide.push_back( Tlv( 0x80 + i % 4, (uint8_t)i ) );
+    }
+    const auto buf = wide.dump();
+    CountingResource resource;
+    Tlv::Status s;
+    auto tlv = Tlv::parse( buf.data(), buf.size(), s, Tlv::Deep, &resource );
+    CHECK( s.ok() );
+    size_t allocations = resource.allocations;
+    CHECK( tlv.find( 0x82 ).value() == unhexify( "02" ) );
+    CHECK( resource.allocations > allocations );
+    tlv.push_back( Tlv( 0x84, (uint8_t)40 ) );
+    CHECK( tlv.find( 0x84 ).value() == unhexify( "28" ) );
+    CHECK_EQUAL( 10, tlv.find_all( 0x81 ).size() );
+
+    tlv.reset();
+    CHECK_EQUAL( resource.allocations, resource.deallocations );
+}
+
+TEST(TlvArena, Clone)
+{
+    Tlv root( 0xE1 );
+    for( int i = 0; i < 6; i++ )
+    {
+        Tlv record( 0x70 );
+        record.push_back( Tlv( 0x5A, std::string( 20, 'a' + i ) ) );
+        record.push_back( Tlv( 0x9F02, (uint8_t)i ) );
+        root.push_back( record );
+    }
+    Tlv child = root.front();
+
+    CountingResource resource;
+    {
+        Tlv copy = child.clone( &resource );
+        CHECK_FALSE( copy.has_parent() );
+        CHECK( copy.dump() == child.dump() );
+
+        copy = root.clone( &resource );
+        CHECK_EQUAL( 2, resource.allocations );
+        CHECK_EQUAL( 1, resource.deallocations );
+        CHECK( copy.dump() == root.dump() );
+        CHECK_FALSE( copy.front().identical( child ) );
+        CHECK( copy.front().front().value().get_allocator().resource() == copy.children().get_allocator().resource() );
+
+        // copy is independent, later allocations use the resource
+        Tlv leaf = copy.back().front();
+        leaf.value().resize( 100, 'z' );
+        CHECK_EQUAL( 3, resource.allocations );
+        CHECK( root.back().front().value() == std::vector<uint8_t>( 20, 'f' ) );
+
+        // block is released with the last node
+        copy.reset();
+        CHECK_EQUAL( 1, resource.deallocations );
+    }
+    CHECK_EQUAL( resource.allocations, resource.deallocations );
+}
+
+TEST(TlvArena, ParseFormattedIntoArena)
+{
+    CountingResource resource;
+    Tlv::Status s;
+    auto tlv = Tlv::parse_formatted( "BF01\n    8A 0102\n    8B 03\n", s, &resource );
+    CHECK( s.ok() );
+    STRCMP_EQUAL( "BF01078A0201028B0103", hexify( tlv.dump() ).c_str() );
+    CHECK( resource.allocations >= 3 );
+
+    // expanded values allocate child nodes from the resource of the expanded node
+    auto allocations = resource.allocations;
+    auto _8A = tlv.find( 0xBF01 ).find( 0x8A );
+    _8A.set_tag( 0xAA );
+    _8A.set_value( unhexify( "8B0103" ) );
+    CHECK( _8A.expand().ok() );
+    CHECK( resource.allocations > allocations );
+
+    tlv.reset();
+    _8A.reset();
+    CHECK_EQUAL( resource.allocations, resource.deallocations );
+}
+
+/*
+ * TlvSnapshot
+ */
+
+TEST_GROUP(TlvSnapshot)
+{};
+
+namespace
+{
+    Tlv build_profile()
+    {
+        Tlv root( 0xE1 );
+        Tlv record( 0x70 );
+        record.push_back( Tlv( 0x5A, (uint16_t)0x1234 ) );
+        record.push_back( Tlv( 0x9F02, (uint8_t)1 ) );
+        root.push_back( record );
+        root.push_back( Tlv( 0x71, Tlv( 0x86, (uint8_t)2 ) ) );
+        return root;
+    }
+}
+
+TEST(TlvSnapshot, CopyOnWrite)
+{
+    Tlv root = build_profile();
+    const auto encoded = root.dump();
+    Tlv leaf = root.find( 0x70 ).find( 0x5A );
+    Tlv record = root.find( 0x70 );
+    const TlvSnapshot snapshot = root.snapshot();
+    CHECK( snapshot.dump() == encoded );
+    CHECK( snapshot.find( 0x70 ).identical( record ) );
+
+    // modified path is copied, the handle moves to the copy
+    leaf.set_value( unhexify( "5678" ) );
+    STRCMP_EQUAL( "E10F7008" "5A025678" "9F020101" "71038601" "02", hexify( root.dump() ).c_str() );
+    CHECK( snapshot.dump() == encoded );
+    CHECK( root.find( 0x70 ).find( 0x5A ).identical( leaf ) );
+    CHECK_FALSE( snapshot.find( 0x70 ).identical( root.find( 0x70 ) ) );
+    CHECK( snapshot.find( 0x71 ).identical( root.find( 0x71 ) ) );
+
+    // reading through snapshot handles keeps the nodes shared
+    TlvSnapshot amount = snapshot.find( 0x71 ).front();
+    CHECK( amount.value() == unhexify( "02" ) );
+    CHECK( amount.identical( root.find( 0x71 ).front() ) );
+
+    // copies are not shared, further modifications are in place
+    leaf.value()[1] = 0x79;
+    CHECK( root.find( 0x70 ).find( 0x5A ).identical( leaf ) );
+    CHECK( root.find( 0x70 ).find( 0x5A ).value() == unhexify( "5679" ) );
+
+    // other handles to a copied node read the snapshot, but modify the tree
+    CHECK( record.dump() == snapshot.find( 0x70 ).dump() );
+    record.push_back( Tlv( 0x5F24, (uint8_t)3 ) );
+    STRCMP_EQUAL( "E113700C" "5A025679" "9F020101" "5F240103" "71038601" "02", hexify( root.dump() ).c_str() );
+    CHECK( snapshot.dump() == encoded );
+}
+
+TEST(TlvSnapshot, Structure)
+{
+    Tlv root = build_profile();
+    const auto encoded = root.dump();
+    const TlvSnapshot snapshot = root.snapshot();
+
+    root.push_back( Tlv( 0x72 ) );
+    root.pop_front();
+    Tlv moved = root.find( 0x71 ).front();
+    moved.detach();
+    CHECK_FALSE( moved.has_parent() );
+    moved.set_tag( 0x87 );
+    root.push_back( moved );
+    CHECK_EQUAL( 2, root.remove_if( []( const Tlv& child ) { return !( child.tag() == Tlv::Tag( 0x87 ) ); } ) );
+    STRCMP_EQUAL( "E103870102", hexify( root.dump() ).c_str() );
+    CHECK( snapshot.dump() == encoded );
+
+    // copies of a snapshot share its nodes
+    TlvSnapshot second = snapshot;
+    CHECK( second.find( 0x70 ).identical( snapshot.find( 0x70 ) ) );
+    CHECK_EQUAL( 2, second.children().size() );
+    CHECK( second.back().front().value() == unhexify( "02" ) );
+}
+
+TEST(TlvSnapshot, WideNode)
+{
+    Tlv root( 0xE1 );
+    for( int i = 0; i < 40; i++ )
+    {
+        root.push_back( Tlv( 0x80 + i % 4, (uint8_t)i ) );
+    }
+    Tlv child = root.find( 0x81 );
+    {
+        const TlvSnapshot snapshot = root.snapshot();
+        child.set_value( unhexify( "FF" ) );
+        CHECK( snapshot.find( 0x81 ).value() == unhexify( "01" ) );
+        CHECK_EQUAL( 10, snapshot.find_all( 0x81 ).size() );
+    }
+
+    // the tag index refers to the copy that replaced the shared child
+    CHECK( root.find( 0x81 ).identical( child ) );
+    CHECK( root.find( 0x81 ).value() == unhexify( "FF" ) );
+    CHECK_EQUAL( 10, root.find_all( 0x81 ).size() );
+}
+
+TEST(TlvSnapshot, Released)
+{
+    // nodes are only copied while a snapshot that shares them is alive, snapshots of other trees don't matter
+    Tlv root = build_profile();
+    root.snapshot();
+    Tlv first = root.find( 0x70 );
+    Tlv second = root.find( 0x70 );
+    Tlv other = build_profile();
+    const TlvSnapshot snapshot = other.snapshot();
+    first.push_back( Tlv( 0x5F24, (uint8_t)3 ) );
+    CHECK( first.identical( second ) );
+    CHECK( second.find( 0x5F24 ).value() == unhexify( "03" ) );
+    CHECK( snapshot.dump() == build_profile().dump() );
+
+    // detached nodes stay shared with a snapshot that contains them
+    const TlvSnapshot held = root.snapshot();
+    const auto encoded = held.dump();
+    second.detach();
+    second.push_back( Tlv( 0x5F25, (uint8_t)4 ) );
+    CHECK_FALSE( second.find( 0x5F25 ).empty() );
+    CHECK( held.dump() == encoded );
+    CHECK( held.find( 0x70 ).find( 0x5F25 ).empty() );
+}
+
+TEST(TlvSnapshot, ConcurrentReaders)
+{
+    Tlv root = build_profile();
+    Tlv leaf = root.find( 0x70 ).find( 0x9F02 );
+    std::vector<std::thread> readers;
+    bool consistent[4] = {};
+    for( int i = 0; i < 4; i++ )
+    {
+        const TlvSnapshot snapshot = root.snapshot();
+        const auto encoded = snapshot.dump();
+        readers.emplace_back( [snapshot, encoded, &consistent, i]()
+        {
+            bool ok = true;
+            for( int n = 0; n < 200; n++ )
+            {
+                // snapshot handles only read the shared nodes
+                TlvSnapshot amount = snapshot.find( 0x70 ).find( 0x9F02 );
+                ok = ok && snapshot.dump() == encoded && amount.value() == Tlv::Value( encoded.end() - 6, encoded.end() - 5 );
+            }
+            consistent[i] = ok;
+        } );
+
+        for( int n = 0; n < 100; n++ )
+        {
+            leaf.value()[0]++;
+            root.find( 0x71 ).push_back( Tlv( 0x87 ) );
+            root.find( 0x71 ).pop_back();
+        }
+    }
+    for( auto& reader : readers )
+    {
+        reader.join();
+    }
+    for( bool ok : consistent )
+    {
+        CHECK( ok );
+    }
+}
+
+/*
+ * FlatTlv
+ */
+
+TEST_GROUP(FlatTlv)
+{};
+
+TEST(FlatTlv, ParseAll)
+{
+    const auto buf = unhexify( "450101BF85010EAA068A047465737493040ABBCCDD5F41020345" );
+    Tlv::Status s;
+    auto flat = FlatTlv::parse_all( buf.data(), buf.size(), s );
+    CHECK( s.ok() );
+    CHECK_EQUAL( buf.size(), s.parsed_len() );
+    CHECK_EQUAL( 7, flat.size() );
+
+    auto root = flat.root();
+    CHECK_FALSE( root.has_tag() );
+    CHECK_EQUAL( 3, root.num_children() );
+    CHECK_EQUAL( 7, root.tree_size() );
+
+    auto _BF8501 = root.first_child().next_sibling();
+    CHECK_EQUAL( 0xBF8501, _BF8501.tag().value() );
+    CHECK_EQUAL( 2, _BF8501.num_children() );
+    CHECK_FALSE( _BF8501.has_value() );
+    CHECK( _BF8501.parent() == root );
+
+    auto _8A = flat.find( 0x8A, Tlv::Deep );
+    CHECK_EQUAL( 4, _8A.index() );
+    STRCMP_EQUAL( "74657374", hexify( _8A.value().to_vector() ).c_str() );
+    CHECK( _8A.parent().parent() == _BF8501 );
+    CHECK_FALSE( _8A.next_sibling() );
+    CHECK_EQUAL( 0x93, _8A.parent().next_sibling().tag().value() );
+
+    CHECK( flat.dump() == buf );
+    CHECK( _BF8501.dump() == Tlv::parse_all( buf.data(), buf.size(), s ).find( 0xBF8501 ).dump() );
+}
+
+TEST(FlatTlv, Queries)
+{
+    const auto buf = unhexify( "BF0110DA03414243DA03444546AA04100201021101FFDA0100" );
+    Tlv::Status s;
+    auto tlv = Tlv::parse_all( buf.data(), buf.size(), s );
+    auto flat = FlatTlv::parse_all( buf.data(), buf.size(), s );
+    CHECK( s.ok() );
+
+    CHECK_EQUAL( 1, flat.find_all( 0xDA ).size() );
+    CHECK_EQUAL( 3, flat.find_all( 0xDA, Tlv::Deep ).size() );
+    CHECK_EQUAL( 3, flat.find_all( 0xDA, 2 ).size() );
+    CHECK_EQUAL( tlv.find_all( 0x10, 3 ).size(), flat.find_all( 0x10, 3 ).size() );
+    CHECK_EQUAL( 0, flat.find_all( 0x10, 2 ).size() );
+    CHECK_EQUAL( 7, flat.find( 0xDA ).index() );
+    CHECK_EQUAL( 2, flat.find( 0xDA, Tlv::Deep ).index() );
+    CHECK_EQUAL( 2, flat.find( 0xDA, 2 ).index() );
+    CHECK_FALSE( flat.find( 0x10, 2 ) );
+
+    // dfs with pruning yields the same order as for Tlv
+    std::string tlvOrder, flatOrder;
+    tlv.dfs( [&]( Tlv& node, int depth ) {
+        tlvOrder += node.tag().to_hex_string() + ":" + std::to_string( depth ) + " ";
+        return node.tag().value() == 0xAA ? Tlv::Prune : Tlv::Continue;
+    } );
+    flat.dfs( [&]( const FlatTlv::Node& node, int depth ) {
+        flatOrder += node.tag().to_hex_string() + ":" + std::to_string( depth ) + " ";
+        return node.tag().value() == 0xAA ? Tlv::Prune : Tlv::Continue;
+    } );
+    STRCMP_EQUAL( tlvOrder.c_str(), flatOrder.c_str() );
+
+    CHECK( flat.to_tlv().dump() == tlv.dump() );
+    CHECK( flat.to_tlv().dump_formatted() == tlv.dump_formatted() );
+}
+
+TEST(FlatTlv, ParseDepth)
+{
+    const auto buf = unhexify( "BF100AAA058B034142431001008C01FF" );
+    Tlv::Status s;
+    auto flat = FlatTlv::parse( buf.data(), buf.size(), s, 2 );
+    CHECK( s.ok() );
+    CHECK_EQUAL( 3, flat.size() );
+    CHECK_EQUAL( 0xBF10, flat.root().tag().value() );
+    CHECK_EQUAL( 5, flat.find( 0xAA ).value_size() );
+    CHECK( flat.dump() == std::vector<uint8_t>( buf.begin(), buf.begin() + 13 ) );
+
+    flat = FlatTlv::parse( buf.data(), 12, s );
+    CHECK_EQUAL( Tlv::Status::UnexpectedEnd, s.code() );
+    CHECK( flat.empty() );
+}
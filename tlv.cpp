@@ -4,9 +4,20 @@
 #include <stack>
 #include <functional>
 #include <algorithm>
+#include <new>
 #include <cassert>
+#include <atomic>
+#include <thread>
+#include <exception>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
 #include <tlv.hpp>
 
+#ifndef LIBTLV_ATOMIC_REFCOUNT
+#define LIBTLV_ATOMIC_REFCOUNT 1
+#endif
+
 namespace LibtlvUtil
 {
     std::vector<uint8_t> unhexify( std::string_view hexInput, bool throw_ex )
@@ -52,15 +63,20 @@ namespace LibtlvUtil
     }
 
     std::string hexify( const std::vector<uint8_t> &data, bool lower_case )
+    {
+        return hexify( data.data(), data.size(), lower_case );
+    }
+
+    std::string hexify( const uint8_t *data, size_t size, bool lower_case )
     {
         const char* characters = lower_case ? "0123456789abcdef" : "0123456789ABCDEF";
         std::string hexString;
-        hexString.reserve( data.size()*2 );
+        hexString.reserve( size*2 );
 
-        for ( const auto &byte : data )
+        for ( const uint8_t* byte = data; byte < data + size; byte++ )
         {
-          hexString += characters[byte >> 4];
-          hexString += characters[byte & 0x0F];
+          hexString += characters[*byte >> 4];
+          hexString += characters[*byte & 0x0F];
         }
 
         return hexString;
@@ -71,10 +87,482 @@ namespace LibtlvUtil
     {
         return value >> ( 8 * ( sizeof(value) - __builtin_clz( value ) / 8 - 1 ) );
     }
+
+    // stack with inline storage for the first N elements, only deep trees allocate
+    template< typename T, size_t N >
+    class InlineStack
+    {
+        T _inline[N];
+        std::vector<T> _overflow;
+        size_t _size;
+
+    public:
+        InlineStack() : _size( 0 ) {}
+
+        bool empty() const { return _size == 0; }
+        size_t size() const { return _size; }
+
+        void push_back( const T& value )
+        {
+            if( _size < N )
+                _inline[_size] = value;
+            else
+                _overflow.push_back( value );
+            _size++;
+        }
+
+        void pop_back()
+        {
+            _size--;
+            if( _size >= N )
+                _overflow.pop_back();
+        }
+
+        T& back()
+        {
+            return _size <= N ? _inline[_size - 1] : _overflow.back();
+        }
+    };
 }
 
 using namespace LibtlvUtil;
 
+namespace
+{
+    // size of definite length field
+    size_t len_field_size( size_t len )
+    {
+        if( len <= 127 )
+            return 1;
+        else
+            return 4 - __builtin_clz( len ) / 8 + 1;
+    }
+
+    // size of tag and definite length field, nodes without tag have no header
+    size_t header_size( const Tlv::Tag tag, size_t len )
+    {
+        return tag.empty() ? 0 : tag.size() + len_field_size( len );
+    }
+
+    // maximum size of tag and definite length field
+    const size_t max_header_size = 9;
+
+    // long form length field with four length bytes, reserved for lengths that are not known yet
+    const size_t reserved_len_field_size = 5;
+
+    // nodes with at least this many children index them by tag on the first lookup
+    const size_t tag_index_threshold = 32;
+
+    /* Inputs of parsed nodes. Nodes refer to their input by id and hold a reference each, so that a node
+     * only stores the position of its encoding. Entries are never moved, ids of released inputs are reused. */
+    class SourceTable
+    {
+    public:
+        typedef uint32_t Id;    // 0 for no input
+
+        static SourceTable& instance()
+        {
+            // never destroyed, nodes may be released during static destruction
+            static SourceTable* table = new SourceTable();
+            return *table;
+        }
+
+        // new id with refs references, 0 if the table is full
+        Id acquire( const Tlv::Source& input, uint32_t refs )
+        {
+            std::lock_guard<std::mutex> lock( _mutex );
+            Id id;
+            if( !_free.empty() )
+            {
+                id = _free.back();
+                _free.pop_back();
+            }
+            else if( _next < chunk_size * max_chunks )
+            {
+                id = _next++;
+                std::atomic<Entry*>& chunk = _chunks[id / chunk_size];
+                if( !chunk.load( std::memory_order_relaxed ) )
+                {
+                    chunk.store( new Entry[chunk_size], std::memory_order_release );
+                }
+            }
+            else
+            {
+                return 0;
+            }
+            Entry& e = entry( id );
+            e.input = input;
+            e.refs.store( refs, std::memory_order_relaxed );
+            return id;
+        }
+
+        // only called for ids with a reference
+        void retain( Id id, uint32_t refs )
+        {
+            entry( id ).refs.fetch_add( refs, std::memory_order_relaxed );
+        }
+
+        void release( Id id )
+        {
+            Entry& e = entry( id );
+            if( e.refs.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+            {
+                std::lock_guard<std::mutex> lock( _mutex );
+                e.input.reset();
+                _free.push_back( id );
+            }
+        }
+
+        const Tlv::Source& input( Id id ) const
+        {
+            return entry( id ).input;
+        }
+
+    private:
+        struct Entry
+        {
+            Tlv::Source input;
+            std::atomic<uint32_t> refs;
+        };
+        static constexpr size_t chunk_size = 1024;
+        static constexpr size_t max_chunks = 4096;
+
+        Entry& entry( Id id ) const
+        {
+            return _chunks[id / chunk_size].load( std::memory_order_acquire )[id % chunk_size];
+        }
+
+        std::mutex _mutex;
+        std::vector<Id> _free;
+        Id _next = 1;
+        std::atomic<Entry*> _chunks[max_chunks] = {};
+    };
+
+    /* Memory of a cloned tree: nodes, values and child lists are placed into one block, which is
+     * released together with the resource when all of them are. Later allocations of the tree,
+     * e.g. for growing values, go to the upstream resource. */
+    class CloneResource : public std::pmr::memory_resource
+    {
+    public:
+        static constexpr size_t unit = alignof( std::max_align_t );
+
+        // size of an allocation in the block
+        static size_t block_size( size_t bytes )
+        {
+            return ( bytes + unit - 1 ) / unit * unit;
+        }
+
+        // resource at the start of a block with room for size bytes
+        static CloneResource* create( std::pmr::memory_resource* upstream, size_t size )
+        {
+            size_t total = block_size( sizeof( CloneResource ) ) + size;
+            void* block = upstream->allocate( total, unit );
+            return new( block ) CloneResource( upstream, total );
+        }
+
+    private:
+        std::pmr::memory_resource* _upstream;
+        uint8_t* _block;
+        size_t _size;
+        size_t _used;
+        std::atomic<size_t> _live;     // allocations that were not deallocated yet
+
+        CloneResource( std::pmr::memory_resource* upstream, size_t size ) :
+            _upstream( upstream ),
+            _block( reinterpret_cast<uint8_t*>( this ) ),
+            _size( size ),
+            _used( block_size( sizeof( CloneResource ) ) ),
+            _live( 0 )
+        {}
+
+        // allocations from upstream are unrelated to the block, std::less orders any pointers
+        bool in_block( const void* p ) const
+        {
+            std::less<const void*> less;
+            return !less( p, _block ) && less( p, _block + _size );
+        }
+
+        void* do_allocate( size_t bytes, size_t alignment ) override
+        {
+            _live.fetch_add( 1, std::memory_order_relaxed );
+            if( alignment <= unit && block_size( bytes ) <= _size - _used )
+            {
+                void* p = _block + _used;
+                _used += block_size( bytes );
+                return p;
+            }
+            return _upstream->allocate( bytes, alignment );
+        }
+
+        void do_deallocate( void* p, size_t bytes, size_t alignment ) override
+        {
+            if( !in_block( p ) )
+            {
+                _upstream->deallocate( p, bytes, alignment );
+            }
+            if( _live.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+            {
+                std::pmr::memory_resource* upstream = _upstream;
+                size_t size = _size;
+                this->~CloneResource();
+                upstream->deallocate( this, size, unit );
+            }
+        }
+
+        bool do_is_equal( const std::pmr::memory_resource& other ) const noexcept override
+        {
+            return this == &other;
+        }
+    };
+
+    // encode tag bytes into out
+    size_t write_tag( uint8_t* out, const Tlv::Tag tag )
+    {
+        uint8_t* pos = out;
+        for( int i = tag.size() - 1; i >= 0; i-- )
+        {
+            *pos++ = ( tag.value() >> ( i * 8 ) ) & 0xFF;
+        }
+        return pos - out;
+    }
+
+    // encode length into a reserved length field
+    void write_reserved_len( uint8_t* out, uint32_t len )
+    {
+        *out++ = (uint8_t)( 0x80 | ( reserved_len_field_size - 1 ) );
+        for( int i = reserved_len_field_size - 2; i >= 0; i-- )
+        {
+            *out++ = ( len >> ( i * 8 ) ) & 0xFF;
+        }
+    }
+
+    // encode definite length field of given size, short form if the size is 1, returns 0 if the length does not fit
+    size_t write_len_field( uint8_t* out, size_t len, size_t size )
+    {
+        if( size == 1 )
+        {
+            // Definite short form
+            if( len > 127 )
+                return 0;
+            *out = len & 0x7F;
+            return 1;
+        }
+
+        // Definite long form
+        size_t len_bytes = size - 1;
+        if( len_bytes > sizeof( uint32_t ) || ( len_bytes < sizeof( uint32_t ) && len >> ( len_bytes * 8 ) != 0 ) )
+            return 0;
+        *out++ = (uint8_t)( 0x80 | len_bytes );
+        for( int i = len_bytes - 1; i >= 0; i-- )
+        {
+            *out++ = ( len >> ( i * 8 ) ) & 0xFF;
+        }
+        return size;
+    }
+
+    // encode tag and definite length field into out, nodes without tag have no header
+    size_t write_header( uint8_t* out, const Tlv::Tag tag, size_t len )
+    {
+        if( tag.empty() )
+        {
+            return 0;
+        }
+
+        uint8_t* pos = out + write_tag( out, tag );
+        return pos + write_len_field( pos, len, len_field_size( len ) ) - out;
+    }
+
+    // size of the end-of-contents marker of indefinite length nodes
+    const size_t eoc_size = 2;
+
+    /* Finds the end-of-contents marker of an indefinite length node. Only headers are decoded, values of
+     * definite length nodes are skipped, and nested indefinite length nodes are matched by depth, so
+     * zero bytes inside values are not mistaken for the marker. The content may arrive in parts, scanning
+     * resumes at the first header that was incomplete. */
+    class EocMatcher
+    {
+        size_t _pos;        // offset of the next header relative to the start of the content
+        size_t _depth;      // open indefinite length nodes
+
+    public:
+        enum Result
+        {
+            Found,
+            NeedMore,
+            Malformed
+        };
+
+        EocMatcher() : _pos( 0 ), _depth( 1 ) {}
+        EocMatcher( size_t pos, size_t depth ) : _pos( pos ), _depth( depth ) {}
+
+        // offset of the matching end-of-contents marker after Found, otherwise where scanning resumes
+        size_t position() const { return _pos; }
+        size_t depth() const { return _depth; }
+
+        // content is all data received so far, starting after the header of the indefinite length node
+        Result scan( const uint8_t* content, size_t size )
+        {
+            static constexpr const uint8_t multi_octet_tag_mask = 0x1F;
+            static constexpr const uint8_t more_octet_mask = 0x80;
+            static constexpr const uint8_t constructed_mask = 0x20;
+
+            while( _pos < size )
+            {
+                const uint8_t* pos = content + _pos;
+                const uint8_t* end = content + size;
+
+                // end-of-contents, or a single padding byte
+                if( *pos == 0 )
+                {
+                    if( pos + 1 == end )
+                        return NeedMore;
+                    if( pos[1] != 0 )
+                    {
+                        _pos++;
+                        continue;
+                    }
+                    if( --_depth == 0 )
+                        return Found;
+                    _pos += eoc_size;
+                    continue;
+                }
+
+                // tag
+                const bool constructed = *pos & constructed_mask;
+                if( ( *pos++ & multi_octet_tag_mask ) == multi_octet_tag_mask )
+                {
+                    size_t tagSize = 1;
+                    do
+                    {
+                        if( pos == end )
+                            return NeedMore;
+                        if( ++tagSize > sizeof( uint32_t ) )
+                            return Malformed;
+                    } while( *pos++ & more_octet_mask );
+                }
+
+                // length
+                if( pos == end )
+                    return NeedMore;
+                uint8_t byte = *pos++;
+                uint64_t length = byte;
+                if( byte == more_octet_mask )
+                {
+                    if( !constructed )
+                        return Malformed;
+                    _depth++;
+                    _pos = pos - content;
+                    continue;
+                }
+                if( byte & more_octet_mask )
+                {
+                    size_t num_bytes = byte ^ more_octet_mask;
+                    if( num_bytes > sizeof( uint32_t ) )
+                        return Malformed;
+                    if( static_cast<size_t>( end - pos ) < num_bytes )
+                        return NeedMore;
+                    length = 0;
+                    for( size_t i = 0; i < num_bytes; i++ )
+                    {
+                        length = ( length << 8 ) + *pos++;
+                    }
+                }
+                // value may end beyond the data received so far
+                _pos = ( pos - content ) + length;
+            }
+            return NeedMore;
+        }
+    };
+
+    // reference count of tree nodes, plain count if the library is built for trees confined to one thread
+    class RefCount
+    {
+#if LIBTLV_ATOMIC_REFCOUNT
+        std::atomic<uint32_t> _count;
+
+    public:
+        RefCount() : _count( 0 ) {}
+        void retain() { _count.fetch_add( 1, std::memory_order_relaxed ); }
+        // true if the last reference was released
+        bool release() { return _count.fetch_sub( 1, std::memory_order_acq_rel ) == 1; }
+#else
+        uint32_t _count;
+
+    public:
+        RefCount() : _count( 0 ) {}
+        void retain() { _count++; }
+        bool release() { return --_count == 0; }
+#endif
+    };
+
+    // atomic value with relaxed access, for fields that are otherwise used like plain values
+    template< typename T >
+    class RelaxedAtomic
+    {
+        std::atomic<T> _value;
+
+    public:
+        RelaxedAtomic( T value ) : _value( value ) {}
+        operator T() const { return _value.load( std::memory_order_relaxed ); }
+        T operator->() const { return _value.load( std::memory_order_relaxed ); }
+        RelaxedAtomic& operator=( T value )
+        {
+            _value.store( value, std::memory_order_relaxed );
+            return *this;
+        }
+        bool compare_exchange( T& expected, T desired )
+        {
+            return _value.compare_exchange_strong( expected, desired, std::memory_order_relaxed );
+        }
+    };
+
+    // byte buffer that is filled from the end toward the beginning
+    class ReverseBuffer
+    {
+        std::vector<uint8_t> _buf;
+        size_t _begin;      // first used byte
+
+        void grow( size_t len )
+        {
+            // used bytes move to the end of the larger buffer
+            size_t used = size();
+            std::vector<uint8_t> buf( std::max( _buf.size() * 2, used + len ) );
+            std::copy( _buf.begin() + _begin, _buf.end(), buf.end() - used );
+            _buf.swap( buf );
+            _begin = _buf.size() - used;
+        }
+
+    public:
+        explicit ReverseBuffer( size_t capacity ) : _buf( capacity ), _begin( capacity ) {}
+
+        size_t size() const { return _buf.size() - _begin; }
+
+        void prepend( const uint8_t* data, size_t len )
+        {
+            if( len > _begin )
+            {
+                grow( len );
+            }
+            _begin -= len;
+            std::copy( data, data + len, _buf.begin() + _begin );
+        }
+
+        std::vector<uint8_t> release()
+        {
+            _buf.erase( _buf.begin(), _buf.begin() + _begin );
+            _begin = 0;
+            return std::move( _buf );
+        }
+    };
+
+    // append tag and definite length field, nodes without tag have no header
+    void build_header( std::vector<uint8_t> &out, const Tlv::Tag tag, size_t len )
+    {
+        uint8_t header[max_header_size];
+        out.insert( out.end(), header, header + write_header( header, tag, len ) );
+    }
+}
+
 /*
  * TlvTag
  */
@@ -168,6 +656,11 @@ uint32_t Tlv::Tag::tag_number() const
 
 std::string Tlv::Tag::to_hex_string() const
 {
+    if( empty() )
+    {
+        return std::string();
+    }
+
     const char* characters = "0123456789ABCDEF";
     int most_significant_byte = ( sizeof( _value ) - __builtin_clz( _value ) / 8 ) - 1;
     std::string hex_string;
@@ -188,31 +681,157 @@ std::string Tlv::Tag::to_hex_string() const
  */
 struct Tlv::Data
 {
+    static constexpr size_t no_size = std::numeric_limits<size_t>::max();
+
     Tag tag;
-    Data* parent;
+    RefCount refs;
+    // Atomic, because destroying a snapshot on another thread unsets the parent of nodes it owns
+    RelaxedAtomic<Data*> parent;
     // Leaf
     Value value;
     // Branch
     ChildContainer children;
-
-    Data() :
-        parent( nullptr )
+    // Cached size of the encoded value or children, no_size if the node changed since it was computed.
+    // Atomic, because it is updated by const functions.
+    mutable std::atomic<size_t> payload_size;
+    // Cached hash of tag, value and children, no_hash if the node changed since it was computed
+    static constexpr uint64_t no_hash = 0;
+    mutable std::atomic<uint64_t> subtree_hash;
+    // Encoding in the parsed input, only set while neither the node nor its descendants changed.
+    // The input is kept in the source table, the node holds a reference to it.
+    SourceTable::Id source_id;      // 0 without encoding
+    uint32_t encoded_offset;
+    uint32_t encoded_size;
+    // Position in the children of parent, relative to slot_origin of the parent. Front insertion and
+    // removal move the origin. Removal in the middle leaves the slots of following siblings too large,
+    // index_of corrects them.
+    uint32_t slot;
+    uint32_t slot_origin;
+    // Children by tag in document order, built by the first lookup on a node with many children.
+    // Appending and removing the last child update it, other changes of the children drop it.
+    // Allocated from the resource of the node.
+    typedef std::pmr::unordered_map<uint32_t, std::pmr::vector<Data*>> TagIndex;
+    mutable std::atomic<TagIndex*> tag_index;
+    // Copy on write: number of child lists that contain the node. Nodes in a list other than the one of
+    // their parent are shared with a snapshot, either directly or through a node that was copied for a
+    // modification, and their descendants are shared too. Modifications replace shared nodes on the path from the modified node
+    // by copies, forward leads from a replaced node to its copy. Lists of a snapshot may be released on
+    // another thread, which decrements with release order.
+    std::atomic<uint32_t> holders;
+    DataRef forward;
+
+    explicit Data( std::pmr::memory_resource* resource = std::pmr::get_default_resource() ) :
+        parent( nullptr ),
+        value( resource ),
+        children( resource ),
+        payload_size( no_size ),
+        subtree_hash( no_hash ),
+        source_id( 0 ),
+        encoded_offset( 0 ),
+        encoded_size( 0 ),
+        slot( 0 ),
+        slot_origin( 0 ),
+        tag_index( nullptr ),
+        holders( 0 )
     {}
 
     Data( const Data &rhs ) = delete;
     Data operator=( const Data &rhs ) = delete;
 
+    // node, values and child lists are allocated from resource
+    static Data* create( std::pmr::memory_resource* resource )
+    {
+        std::pmr::polymorphic_allocator<Data> allocator( resource );
+        Data* data = allocator.allocate( 1 );
+        return new( data ) Data( resource );
+    }
+
+    static void destroy( Data* data )
+    {
+        std::pmr::polymorphic_allocator<Data> allocator( data->children.get_allocator().resource() );
+        data->~Data();
+        allocator.deallocate( data, 1 );
+    }
+
     ~Data()
     {
-        // make sure that parent ptr of children is unset, when parent is destroyed
+        drop_index();
+        drop_encoding();
+        // make sure that parent ptr of children is unset, when parent is destroyed, shared children may have another parent
         for( auto& child : children )
         {
-            child.data_->parent = nullptr;
+            Data* self = this;
+            child.data_->parent.compare_exchange( self, nullptr );
+            child.data_->holders.fetch_sub( 1, std::memory_order_release );
         }
     }
+
+    const uint8_t* encoded() const
+    {
+        return SourceTable::instance().input( source_id )->data() + encoded_offset;
+    }
+
+    void drop_encoding()
+    {
+        if( source_id )
+        {
+            SourceTable::instance().release( source_id );
+            source_id = 0;
+        }
+    }
+
+    // copy of tag, value and children, which become shared. With adopt the copy becomes their parent.
+    Data* copy( bool adopt )
+    {
+        Data* data = create( children.get_allocator().resource() );
+        data->tag = tag;
+        data->value = value;
+        data->children = children;
+        data->payload_size.store( payload_size.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+        data->subtree_hash.store( subtree_hash.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+        if( source_id )
+        {
+            SourceTable::instance().retain( source_id, 1 );
+            data->source_id = source_id;
+            data->encoded_offset = encoded_offset;
+            data->encoded_size = encoded_size;
+        }
+        data->slot = slot;
+        data->slot_origin = slot_origin;
+        for( auto& child : data->children )
+        {
+            child.data_->holders.fetch_add( 1, std::memory_order_relaxed );
+            if( adopt && child.data_->parent == this )
+            {
+                child.data_->parent = data;
+            }
+        }
+        return data;
+    }
+    // equal tags, values and children, subtrees with different hashes are not compared
     bool operator==( const Data &rhs ) const
     {
-        return tag == rhs.tag && parent == rhs.parent && value == rhs.value && children == rhs.children;
+        InlineStack<std::pair<const Data*, const Data*>, 16> pending;
+        pending.push_back( { this, &rhs } );
+        while( !pending.empty() )
+        {
+            auto [a, b] = pending.back();
+            pending.pop_back();
+            if( a == b )
+            {
+                continue;
+            }
+            if( Tlv::_hash( a ) != Tlv::_hash( b ) || !( a->tag == b->tag ) || a->value != b->value ||
+                a->children.size() != b->children.size() )
+            {
+                return false;
+            }
+            for( size_t i = 0; i < a->children.size(); i++ )
+            {
+                pending.push_back( { a->children[i].data_.get(), b->children[i].data_.get() } );
+            }
+        }
+        return true;
     }
     bool operator!=( const Data &rhs ) const
     {
@@ -222,49 +841,249 @@ struct Tlv::Data
     {
         return tag.empty() && value.empty() && children.empty();
     }
-};
-
-/*
- * Error
- */
-Tlv::Status::Status( const Code code, const size_t length ) :
-    code_( code ),
-    length_( length )
-{}
 
-Tlv::Status::Status( Code code, const size_t length, const char *fmt, ... ) :
-    code_( code ),
-    length_( length )
-{
-    va_list vl, vl2;
-    va_start( vl, fmt );
-    va_copy( vl2, vl );
-    unsigned len = vsnprintf( nullptr, 0, fmt, vl ) + 1;
-    va_end( vl );
-    if ( len > 0 )
+    // shared with a snapshot, see holders
+    bool shared() const
     {
-        message_.resize( len );
-        vsnprintf( (char*)message_.c_str(), len, fmt, vl2 );
+        return holders.load( std::memory_order_acquire ) > ( parent ? 1u : 0u );
     }
-    va_end( vl2 );
-}
-
-/*
- * Parser
- */
-
-class Tlv::Parser
-{
-    static constexpr const uint8_t multi_octet_tag_mask_ = 0x1F;
-    static constexpr const uint8_t more_octet_mask_ = 0x80;
-
-    const uint8_t* _pos;
-    const uint8_t* _end;
-    const uint8_t* _tree_start;
 
-    inline bool next_byte( uint8_t &byte )
+    // add child, which must not have a parent
+    void append( Tlv child )
     {
-        if ( _pos < _end )
+        child.data_->holders.fetch_add( 1, std::memory_order_relaxed );
+        child.data_->parent = this;
+        child.data_->slot = slot_origin + (uint32_t)children.size();
+        if( TagIndex* index = tag_index.load( std::memory_order_relaxed ) )
+        {
+            ( *index )[child.data_->tag.value()].push_back( child.data_.get() );
+        }
+        children.push_back( std::move( child ) );
+    }
+
+    void prepend( Tlv child )
+    {
+        drop_index();
+        child.data_->holders.fetch_add( 1, std::memory_order_relaxed );
+        child.data_->parent = this;
+        child.data_->slot = --slot_origin;
+        children.insert( children.begin(), std::move( child ) );
+    }
+
+    // remove child at index, the parent of the child is unset. Slots of the following siblings are not
+    // renumbered, they are too large by one until index_of finds them.
+    void remove_at( size_t index )
+    {
+        Data* child = children[index].data_.get();
+        TagIndex* tagIndex = tag_index.load( std::memory_order_relaxed );
+        if( tagIndex && index == children.size() - 1 )
+        {
+            // last child is the last one with its tag
+            auto it = tagIndex->find( child->tag.value() );
+            it->second.pop_back();
+            if( it->second.empty() )
+            {
+                tagIndex->erase( it );
+            }
+        }
+        else
+        {
+            drop_index();
+        }
+
+        child->parent = nullptr;
+        child->holders.fetch_sub( 1, std::memory_order_release );
+        children.erase( children.begin() + index );
+        if( index == 0 )
+        {
+            slot_origin++;
+        }
+    }
+
+    // replace child at index by a node with the same tag, e.g. its copy
+    void replace_at( size_t index, const DataRef& node )
+    {
+        Data* child = children[index].data_.get();
+        if( TagIndex* tagIndex = tag_index.load( std::memory_order_relaxed ) )
+        {
+            auto& nodes = ( *tagIndex )[child->tag.value()];
+            std::replace( nodes.begin(), nodes.end(), child, node.get() );
+        }
+        node->holders.fetch_add( 1, std::memory_order_relaxed );
+        child->holders.fetch_sub( 1, std::memory_order_release );
+        children[index].data_ = node;
+    }
+
+    void clear_children()
+    {
+        drop_index();
+        for( auto& child : children )
+        {
+            child.data_->parent = nullptr;
+            child.data_->holders.fetch_sub( 1, std::memory_order_release );
+        }
+        children.clear();
+    }
+
+    // move the children of from behind the children, e.g. to join parsed lists
+    void take_children( Data& from )
+    {
+        for( auto& child : from.children )
+        {
+            Data* data = child.data_.get();
+            append( std::move( child ) );
+            data->holders.fetch_sub( 1, std::memory_order_relaxed );
+        }
+        from.children.clear();
+    }
+
+    // Tag index of children, null if there are too few children. Concurrent lookups may build it
+    // at the same time, only one index is kept.
+    const TagIndex* find_index() const
+    {
+        TagIndex* index = tag_index.load( std::memory_order_acquire );
+        if( index || children.size() < tag_index_threshold )
+        {
+            return index;
+        }
+
+        auto destroy = [this]( TagIndex* index ) { destroy_index( index ); };
+        std::unique_ptr<TagIndex, decltype( destroy )> built( create_index(), destroy );
+        for( auto& child : children )
+        {
+            ( *built )[child.data_->tag.value()].push_back( child.data_.get() );
+        }
+        if( tag_index.compare_exchange_strong( index, built.get(), std::memory_order_acq_rel ) )
+        {
+            return built.release();
+        }
+        return index;
+    }
+
+    void drop_index()
+    {
+        if( TagIndex* index = tag_index.exchange( nullptr, std::memory_order_relaxed ) )
+        {
+            destroy_index( index );
+        }
+    }
+
+    // index and its lists use the resource of the node, the map passes it to the lists
+    TagIndex* create_index() const
+    {
+        std::pmr::polymorphic_allocator<TagIndex> allocator( children.get_allocator().resource() );
+        TagIndex* index = allocator.allocate( 1 );
+        try
+        {
+            allocator.construct( index );
+        }
+        catch( ... )
+        {
+            allocator.deallocate( index, 1 );
+            throw;
+        }
+        return index;
+    }
+
+    void destroy_index( TagIndex* index ) const
+    {
+        std::pmr::polymorphic_allocator<TagIndex> allocator( children.get_allocator().resource() );
+        index->~TagIndex();
+        allocator.deallocate( index, 1 );
+    }
+
+    void renumber( size_t first )
+    {
+        for( size_t i = first; i < children.size(); i++ )
+        {
+            children[i].data_->slot = slot_origin + (uint32_t)i;
+        }
+    }
+
+    /* Index of child in children, the slot of the child is corrected if it was stale. Removal in the middle
+     * leaves the child before its slot, so the list is searched down from the slot and up from the front
+     * at the same time, which compares no more entries than twice a scan from the front. Children that
+     * were reordered through iterators may also be behind their slot. */
+    size_t index_of( Data* child )
+    {
+        const size_t size = children.size();
+        size_t slot = (uint32_t)( child->slot - slot_origin );
+        if( slot < size && children[slot].data_.get() == child )
+        {
+            return slot;
+        }
+
+        size_t index = size;
+        size_t down = std::min( slot, size );
+        for( size_t up = 0; up < down; up++ )
+        {
+            if( children[up].data_.get() == child )
+            {
+                index = up;
+                break;
+            }
+            if( children[--down].data_.get() == child )
+            {
+                index = down;
+                break;
+            }
+        }
+        for( size_t i = slot + 1; index == size && i < size; i++ )
+        {
+            if( children[i].data_.get() == child )
+            {
+                index = i;
+            }
+        }
+        if( index < size )
+        {
+            child->slot = slot_origin + (uint32_t)index;
+        }
+        return index;
+    }
+};
+
+/*
+ * Error
+ */
+Tlv::Status::Status( const Code code, const size_t length ) :
+    code_( code ),
+    length_( length )
+{}
+
+Tlv::Status::Status( Code code, const size_t length, const char *fmt, ... ) :
+    code_( code ),
+    length_( length )
+{
+    va_list vl, vl2;
+    va_start( vl, fmt );
+    va_copy( vl2, vl );
+    unsigned len = vsnprintf( nullptr, 0, fmt, vl ) + 1;
+    va_end( vl );
+    if ( len > 0 )
+    {
+        message_.resize( len );
+        vsnprintf( (char*)message_.c_str(), len, fmt, vl2 );
+    }
+    va_end( vl2 );
+}
+
+/*
+ * Parser
+ */
+
+class Tlv::Parser
+{
+    static constexpr const uint8_t multi_octet_tag_mask_ = 0x1F;
+    static constexpr const uint8_t more_octet_mask_ = 0x80;
+
+    const uint8_t* _pos;
+    const uint8_t* _end;
+    const uint8_t* _tree_start;
+
+    inline bool next_byte( uint8_t &byte )
+    {
+        if ( _pos < _end )
         {
             byte = *_pos;
             _pos++;
@@ -286,20 +1105,33 @@ public:
         Tlv::Tag tag;
         const uint8_t* begin;
         const uint8_t* end;
+        const uint8_t* encoded_end;     // end of the node, after the end-of-contents of indefinite length nodes
 
         ShallowNode() :
             tag(),
             begin( nullptr ),
-            end( nullptr )
+            end( nullptr ),
+            encoded_end( nullptr )
         {}
     };
 
+    Parser() :
+        _pos( nullptr ),
+        _end( nullptr ),
+        _tree_start( nullptr )
+    {}
+
     Parser( const uint8_t* begin, const uint8_t* end, const uint8_t* tree_start ) :
         _pos( begin ),
         _end( end ),
         _tree_start( tree_start )
     {}
 
+    const uint8_t* position() const
+    {
+        return _pos;
+    }
+
     bool has_next_tag()
     {
         skip_zero_bytes();
@@ -356,6 +1188,33 @@ public:
             return Tlv::Status( Tlv::Status::UnexpectedEnd, get_offset(),
                 "Unexpected end of input while reading length of tag '%X' at offset %d", tag, static_cast<int>( get_offset() ) );
 
+        // Indefinite length, content ends at the matching end-of-contents
+        if( byte == more_octet_mask_ )
+        {
+            if( !Tlv::Tag( tag ).constructed() )
+                return Tlv::Status( Tlv::Status::BadLength, get_offset(),
+                    "Indefinite length of primitive tag '%X' at offset %d", tag, static_cast<int>( get_offset() ) );
+
+            EocMatcher matcher;
+            node.begin = _pos;
+            switch( matcher.scan( _pos, _end - _pos ) )
+            {
+                case EocMatcher::Found:
+                    node.end = _pos + matcher.position();
+                    node.encoded_end = node.end + eoc_size;
+                    _pos = node.encoded_end;
+                    return Tlv::Status( Tlv::Status::OK, get_offset() );
+                case EocMatcher::NeedMore:
+                    node.end = node.encoded_end = _pos = _end;
+                    return Tlv::Status( Tlv::Status::UnexpectedEnd, get_offset(),
+                        "Unexpected end of input while reading data of tag '%X' at offset %d", tag, static_cast<int>( get_offset() ) );
+                case EocMatcher::Malformed:
+                    _pos += matcher.position();
+                    return Tlv::Status( Tlv::Status::BadLength, get_offset(),
+                        "Malformed content of indefinite length tag '%X' at offset %d", tag, static_cast<int>( get_offset() ) );
+            }
+        }
+
         // Reag tag length other bytes
         if( byte & more_octet_mask_ )
         {
@@ -384,12 +1243,12 @@ public:
 
         if( valueEnd > _end )
         {
-            node.end = _end;
+            node.end = node.encoded_end = _end;
             _pos = _end;
             return Tlv::Status( Tlv::Status::UnexpectedEnd, get_offset(),
                 "Unexpected end of input while reading data of tag '%X' at offset %d", tag, static_cast<int>( get_offset() ) );
         } else {
-            node.end = valueEnd;
+            node.end = node.encoded_end = valueEnd;
             _pos = valueEnd;
             return Tlv::Status( Tlv::Status::OK, get_offset() ); // Status ok
         }
@@ -636,8 +1495,63 @@ public:
  * Tlv
  */
 
+Tlv::DataRef::DataRef( Data* data ) :
+    _data( data )
+{
+    _data->refs.retain();
+}
+
+Tlv::DataRef::DataRef( const DataRef& other ) :
+    _data( other._data )
+{
+    if( _data )
+    {
+        _data->refs.retain();
+    }
+}
+
+Tlv::DataRef& Tlv::DataRef::operator=( const DataRef& other )
+{
+    // retain first, other may be the last reference to a descendant of the released node
+    if( other._data )
+    {
+        other._data->refs.retain();
+    }
+    Data* old = _data;
+    _data = other._data;
+    if( old && old->refs.release() )
+    {
+        Data::destroy( old );
+    }
+    return *this;
+}
+
+Tlv::DataRef& Tlv::DataRef::operator=( DataRef&& other ) noexcept
+{
+    if( this == &other )
+    {
+        return *this;
+    }
+    Data* old = _data;
+    _data = other._data;
+    other._data = nullptr;
+    if( old && old->refs.release() )
+    {
+        Data::destroy( old );
+    }
+    return *this;
+}
+
+Tlv::DataRef::~DataRef()
+{
+    if( _data && _data->refs.release() )
+    {
+        Data::destroy( _data );
+    }
+}
+
 Tlv::Tlv() :
-    data_( std::make_shared<Data>() )
+    data_( Data::create( std::pmr::get_default_resource() ) )
 {}
 
 Tlv::Tlv( const Tag tag ) :
@@ -658,10 +1572,16 @@ Tlv::Tlv( const Tag tag, const Value &&data ) :
     data_->value = std::move( data );
 }
 
+Tlv::Tlv( const Tag tag, const std::vector<uint8_t> &data ) :
+    Tlv( tag )
+{
+    data_->value.assign( data.begin(), data.end() );
+}
+
 Tlv::Tlv( const Tag tag, const uint8_t *data, size_t size ) :
     Tlv( tag )
 {
-    data_->value = Value( data, data + size );
+    data_->value.assign( data, data + size );
 }
 
 Tlv::Tlv( const Tag tag, const char *s ) :
@@ -671,7 +1591,7 @@ Tlv::Tlv( const Tag tag, const char *s ) :
 Tlv::Tlv( const Tag tag, const std::string &s ) :
     Tlv( tag )
 {
-    data_->value = Value( s.data(), s.data() + s.size() );
+    data_->value.assign( s.data(), s.data() + s.size() );
 }
 
 template<typename T>
@@ -808,17 +1728,28 @@ Tlv::Tlv( Tlv &&rhs ) :
     data_( std::move(rhs.data_) )
 {}
 
-Tlv::Tlv( const std::shared_ptr<Data> &data ) :
-    data_( data )
-{}
-
-Tlv::Tlv( std::shared_ptr<Data> &&data ) :
+Tlv::Tlv( DataRef &&data ) :
     data_( std::move(data) )
 {}
 
 Tlv::~Tlv()
 {}
 
+Tlv Tlv::_make( std::pmr::memory_resource* resource )
+{
+    if( !resource || resource == std::pmr::get_default_resource() )
+    {
+        return Tlv();
+    }
+    // node, values and child lists are allocated from resource
+    return Tlv( DataRef( Data::create( resource ) ) );
+}
+
+std::pmr::memory_resource* Tlv::_resource() const
+{
+    return data_->children.get_allocator().resource();
+}
+
 Tlv& Tlv::operator=( const Tlv &rhs )
 {
     data_ = rhs.data_;
@@ -833,12 +1764,12 @@ Tlv& Tlv::operator=( Tlv &&rhs )
 
 bool Tlv::operator==( const Tlv &rhs ) const
 {
-    return *data_ == *rhs.data_;
+    return identical( rhs ) || *data_ == *rhs.data_;
 }
 
 bool Tlv::operator!=( const Tlv &rhs ) const
 {
-    return *data_ != *rhs.data_;
+    return !operator==( rhs );
 }
 
 bool Tlv::identical(const Tlv& other) const
@@ -851,991 +1782,3290 @@ Tlv::operator bool() const
     return !empty();
 }
 
-Tlv Tlv::parse( const uint8_t *data, const size_t size, Status &s, int depth )
+Tlv Tlv::parse( const uint8_t *data, const size_t size, Status &s, int depth, std::pmr::memory_resource *resource )
 {
     Tlv tlv;
-    s = tlv.parse( data, size, depth );
+    s = tlv.parse( data, size, depth, resource );
     return tlv;
 }
 
-Tlv Tlv::parse_all( const uint8_t *data, const size_t size, Status &s, int depth )
+Tlv Tlv::parse_all( const uint8_t *data, const size_t size, Status &s, int depth, std::pmr::memory_resource *resource )
 {
     Tlv root;
-    s = root.parse_all( data, size, depth );
+    s = root.parse_all( data, size, depth, resource );
     return root;
 }
 
-Tlv::Status Tlv::parse( const uint8_t *data, const size_t size, int depth )
+Tlv::Status Tlv::parse( const uint8_t *data, const size_t size, int depth, std::pmr::memory_resource *resource )
 {
-    reset();
+    *this = _make( resource );
     return _parse_one( *this, data, data + size, data, depth );
 }
 
-Tlv::Status Tlv::parse_all(const uint8_t* data, const size_t size, int depth )
+Tlv::Status Tlv::parse_all(const uint8_t* data, const size_t size, int depth, std::pmr::memory_resource *resource )
 {
-    reset();
+    *this = _make( resource );
     return _parse( *this, data, data + size, data, depth );
 }
 
-Tlv Tlv::parse_formatted(const uint8_t *data, const size_t size, Status &s)
+Tlv Tlv::parse( const uint8_t *data, const size_t size, Status &s, const Projection &projection, int depth, std::pmr::memory_resource *resource )
 {
-    Tlv root;
-    s = root.parse_formatted( data, size );
-    return root;
+    Tlv tlv;
+    s = tlv.parse( data, size, projection, depth, resource );
+    return tlv;
 }
 
-Tlv Tlv::parse_formatted(std::string_view data, Status &s)
+Tlv Tlv::parse_all( const uint8_t *data, const size_t size, Status &s, const Projection &projection, int depth, std::pmr::memory_resource *resource )
 {
     Tlv root;
-    s = root.parse_formatted( data );
+    s = root.parse_all( data, size, projection, depth, resource );
     return root;
 }
 
-Tlv::Status Tlv::parse_formatted(const uint8_t *data, const size_t size)
+Tlv::Status Tlv::parse( const uint8_t *data, const size_t size, const Projection &projection, int depth, std::pmr::memory_resource *resource )
 {
-    reset();
-    std::string_view formattedStr( reinterpret_cast<const char*>(data), size );
-    return _parse_formatted( *this, formattedStr );
+    *this = _make( resource );
+    return _parse_one( *this, data, data + size, data, depth, &projection );
 }
 
-Tlv::Status Tlv::parse_formatted( std::string_view data )
+Tlv::Status Tlv::parse_all( const uint8_t *data, const size_t size, const Projection &projection, int depth, std::pmr::memory_resource *resource )
 {
-    reset();
-    return _parse_formatted( *this, data );
+    *this = _make( resource );
+    return _parse( *this, data, data + size, data, depth, &projection );
 }
 
-Tlv::Status Tlv::expand( int depth )
+Tlv Tlv::parse( const Source& source, Status &s, int depth, std::pmr::memory_resource *resource )
 {
-    Status s;
-    if( data_->value.size() > 0 )
-    {
-        s = _parse( *this, data_->value.data(), data_->value.data() + data_->value.size() , &data_->value.front(), depth );
+    Tlv tlv;
+    s = tlv.parse( source, depth, resource );
+    return tlv;
+}
 
-        if( s )
-        {
-            data_->value.clear();
-        }
-        else
-        {
-            data_->children.clear();
-        }
+Tlv Tlv::parse_all( const Source& source, Status &s, int depth, std::pmr::memory_resource *resource )
+{
+    Tlv root;
+    s = root.parse_all( source, depth, resource );
+    return root;
+}
 
-    } else {
-        s = Status( Status::BadArgument, 0, "Node has no value" );
+Tlv::Status Tlv::parse( const Source& source, int depth, std::pmr::memory_resource *resource )
+{
+    *this = _make( resource );
+    if( !source )
+    {
+        return Status( Status::BadArgument, 0, "Missing source" );
     }
+    const uint8_t* data = source->data();
+    return _parse_one( *this, data, data + source->size(), data, depth, nullptr, &source );
+}
 
-    return s;
+Tlv::Status Tlv::parse_all( const Source& source, int depth, std::pmr::memory_resource *resource )
+{
+    *this = _make( resource );
+    if( !source )
+    {
+        return Status( Status::BadArgument, 0, "Missing source" );
+    }
+    // root has no encoding of its own, padding between top-level nodes is dropped
+    const uint8_t* data = source->data();
+    return _parse( *this, data, data + source->size(), data, depth, nullptr, &source );
 }
 
-std::vector<uint8_t> Tlv::dump() const
+Tlv Tlv::parse_all_parallel( const uint8_t *data, const size_t size, Status &s, int depth, unsigned num_threads, std::pmr::memory_resource *resource )
+{
+    Tlv root;
+    s = root.parse_all_parallel( data, size, depth, num_threads, resource );
+    return root;
+}
+
+Tlv::Status Tlv::parse_all_parallel( const uint8_t *data, const size_t size, int depth, unsigned num_threads, std::pmr::memory_resource *resource )
 {
-    struct BuildStackFrame
+    // smaller inputs are not worth the thread overhead
+    static const size_t min_chunk_size = 64 * 1024;
+
+    *this = _make( resource );
+    if( depth <= 0 )
     {
-        const Tlv* node;
-        int nodeNumber;
-        size_t parentOffset;
-    };
+        return Status( Status::BadArgument, 0, "Minimum parse depth is 1" );
+    }
 
-    struct BuildElement
+    if( num_threads == 0 )
     {
-        const Tlv* node;
-        size_t size;
-    };
+        num_threads = std::max( 1u, std::thread::hardware_concurrency() );
+    }
+    // a few chunks per thread balance records of different size
+    size_t max_chunks = std::min<size_t>( num_threads * 4, size / min_chunk_size );
+    if( num_threads < 2 || max_chunks < 2 )
+    {
+        return _parse( *this, data, data + size, data, depth );
+    }
 
-    auto len_field_size = [](size_t len)
+    struct Chunk
     {
-        if( len <= 127 )
-            return 1;
-        else
-            return 4 - __builtin_clz( len ) / 8 + 1;
+        const uint8_t* begin;
+        const uint8_t* end;
+        Tlv root;
+        Status status;
+        std::exception_ptr exception;
     };
 
-    int nodeNumber = 0;
-    std::vector<BuildStackFrame>	buildStack;
-    std::vector<BuildElement>		buildElements;
-    buildStack.push_back( { this, -1, 0 } ); // start with root
-
-    while( !buildStack.empty() )
+    /* Header-only pass over the top-level nodes, chunks end at node boundaries. Malformed data ends the
+     * pass, the last chunk extends to the end of input and its parser reports the error. Errors are
+     * reported in document order, as for parse_all. */
+    std::vector<Chunk> chunks;
+    chunks.reserve( max_chunks + 1 );
+    const size_t chunk_size = size / max_chunks;
+    const uint8_t* chunkBegin = data;
+    Parser parser( data, data + size, data );
+    while( parser.has_next_tag() )
     {
-        auto &currentElement = buildStack.back();
-
-        // unexplored node
-        if( currentElement.nodeNumber == -1 )
+        Parser::ShallowNode node;
+        if( !parser.next( node ) )
+        {
+            break;
+        }
+        if( static_cast<size_t>( node.encoded_end - chunkBegin ) >= chunk_size )
         {
-            // assign node number (dfs order)
-            currentElement.nodeNumber = nodeNumber++;
-            buildElements.push_back( { currentElement.node, 0 } );
+            chunks.push_back( Chunk{ chunkBegin, node.encoded_end, _make( resource ), Status(), nullptr } );
+            chunkBegin = node.encoded_end;
+        }
+    }
+    if( chunkBegin < data + size )
+    {
+        chunks.push_back( Chunk{ chunkBegin, data + size, _make( resource ), Status(), nullptr } );
+    }
 
-            // leaf node: set payload size
-            if( currentElement.node->data_->children.empty() )
+    // calling thread takes part, workers pick the next chunk until all are parsed
+    std::atomic<size_t> nextChunk( 0 );
+    auto worker = [&]()
+    {
+        for( size_t i = nextChunk++; i < chunks.size(); i = nextChunk++ )
+        {
+            Chunk& chunk = chunks[i];
+            try
             {
-                buildElements[currentElement.nodeNumber].size += currentElement.node->data_->value.size();
+                chunk.status = _parse( chunk.root, chunk.begin, chunk.end, data, depth );
             }
-            // branch node: add children to stack
-            else
+            catch( ... )
             {
-                auto &children = currentElement.node->data_->children;
-                size_t off = 0;
-                for( int r = children.size() -1; r >= 0; --r )
-                {
-                    buildStack.push_back({ &children[r], -1, ++off });
+                chunk.exception = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for( size_t i = 1; i < std::min<size_t>( num_threads, chunks.size() ); i++ )
+    {
+        try
+        {
+            threads.emplace_back( worker );
+        }
+        catch( ... )
+        {
+            // thread or vector growth failed, the started threads must still be joined,
+            // continue with them
+            break;
+        }
+    }
+    worker();
+    for( auto& thread : threads )
+    {
+        thread.join();
+    }
+
+    size_t numChildren = 0;
+    for( auto& chunk : chunks )
+    {
+        if( chunk.exception )
+        {
+            std::rethrow_exception( chunk.exception );
+        }
+        if( !chunk.status )
+        {
+            return chunk.status;
+        }
+        numChildren += chunk.root.data_->children.size();
+    }
+
+    // splice top-level nodes of all chunks into the root, in document order
+    data_->children.reserve( numChildren );
+    for( auto& chunk : chunks )
+    {
+        data_->take_children( *chunk.root.data_ );
+    }
+
+    Status status;
+    status.set_parsed_len( size );
+    return status;
+}
+
+Tlv Tlv::parse_formatted(const uint8_t *data, const size_t size, Status &s, std::pmr::memory_resource *resource )
+{
+    Tlv root;
+    s = root.parse_formatted( data, size, resource );
+    return root;
+}
+
+Tlv Tlv::parse_formatted(std::string_view data, Status &s, std::pmr::memory_resource *resource )
+{
+    Tlv root;
+    s = root.parse_formatted( data, resource );
+    return root;
+}
+
+Tlv::Status Tlv::parse_formatted(const uint8_t *data, const size_t size, std::pmr::memory_resource *resource )
+{
+    std::string_view formattedStr( reinterpret_cast<const char*>(data), size );
+    return parse_formatted( formattedStr, resource );
+}
+
+Tlv::Status Tlv::parse_formatted( std::string_view data, std::pmr::memory_resource *resource )
+{
+    *this = _make( resource );
+    return _parse_formatted( *this, data );
+}
+
+Tlv::Status Tlv::expand( int depth )
+{
+    _unshare();
+    Status s;
+    if( data_->value.size() > 0 )
+    {
+        _invalidate( data_.get() );
+        s = _parse( *this, data_->value.data(), data_->value.data() + data_->value.size() , &data_->value.front(), depth );
+
+        if( s )
+        {
+            data_->value.clear();
+        }
+        else
+        {
+            data_->clear_children();
+        }
+
+    } else {
+        s = Status( Status::BadArgument, 0, "Node has no value" );
+    }
+
+    return s;
+}
+
+/*
+ * Projection
+ */
+
+Tlv::Projection::Projection( std::initializer_list<Tag> tags )
+{
+    for( auto tag : tags )
+    {
+        add( tag );
+    }
+}
+
+Tlv::Projection& Tlv::Projection::add( const Tag tag )
+{
+    auto it = std::lower_bound( _tags.begin(), _tags.end(), tag.value() );
+    if( it == _tags.end() || *it != tag.value() )
+    {
+        _tags.insert( it, tag.value() );
+    }
+    return *this;
+}
+
+Tlv::Projection& Tlv::Projection::add_path( const std::vector<Tag>& path )
+{
+    if( !path.empty() )
+    {
+        _paths.emplace_back();
+        for( auto tag : path )
+        {
+            _paths.back().push_back( tag.value() );
+        }
+    }
+    return *this;
+}
+
+bool Tlv::Projection::selects( const Tag tag, const std::vector<uint32_t>& branch ) const
+{
+    if( std::binary_search( _tags.begin(), _tags.end(), tag.value() ) )
+    {
+        return true;
+    }
+    for( auto& path : _paths )
+    {
+        if( path.size() == branch.size() + 1 && path.back() == tag.value() && std::equal( branch.begin(), branch.end(), path.begin() ) )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Tlv::Projection::descends( const Tag tag, const std::vector<uint32_t>& branch ) const
+{
+    // selected tags can be anywhere in the subtree
+    if( !_tags.empty() )
+    {
+        return true;
+    }
+    for( auto& path : _paths )
+    {
+        if( path.size() > branch.size() + 1 && path[branch.size()] == tag.value() && std::equal( branch.begin(), branch.end(), path.begin() ) )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * StreamParser
+ */
+
+Tlv::StreamParser::StreamParser( Callback callback, int depth, size_t max_record_size ) :
+    _callback( std::move( callback ) ),
+    _depth( depth ),
+    _max_record_size( max_record_size )
+{
+    reset();
+}
+
+void Tlv::StreamParser::reset()
+{
+    _state = State::Tag;
+    _status.reset();
+    _offset = 0;
+    _record_offset = 0;
+    _tag = 0;
+    _tag_size = 0;
+    _length = 0;
+    _length_size = 0;
+    _header_size = 0;
+    _eoc_pos = 0;
+    _eoc_depth = 0;
+    _record.clear();
+}
+
+bool Tlv::StreamParser::pending() const
+{
+    return _state != State::Tag;
+}
+
+Tlv::Status Tlv::StreamParser::_fail( Status status )
+{
+    _status = std::move( status );
+    return _status;
+}
+
+Tlv::Status Tlv::StreamParser::_emit( const uint8_t* begin, const uint8_t* end )
+{
+    // header is already decoded, only the value remains to be parsed
+    const uint8_t* valueBegin = end - _length;
+
+    Tlv record;
+    record.data_->tag = _tag;
+    if( record.data_->tag.constructed() && _depth > 1 )
+    {
+        Status s = _parse( record, valueBegin, end, begin, _depth - 1 );
+        if( !s )
+        {
+            s.set_parsed_len( _record_offset + s.parsed_len() );
+            return _fail( s );
+        }
+    }
+    else
+    {
+        record.data_->value.assign( valueBegin, end );
+    }
+
+    _state = State::Tag;
+    _callback( record );
+    return Status();
+}
+
+Tlv::Status Tlv::StreamParser::feed( const uint8_t *data, const size_t size )
+{
+    static constexpr const uint8_t multi_octet_tag_mask = 0x1F;
+    static constexpr const uint8_t more_octet_mask = 0x80;
+
+    if( !_status )
+    {
+        return _status;
+    }
+    if( _depth <= 0 )
+    {
+        return _fail( Status( Status::BadArgument, _offset, "Minimum parse depth is 1" ) );
+    }
+
+    const uint8_t* pos = data;
+    const uint8_t* end = data + size;
+
+    while( pos < end )
+    {
+        if( _state == State::Tag )
+        {
+            // skip padding between top-level nodes
+            if( *pos == 0 )
+            {
+                pos++;
+                _offset++;
+                continue;
+            }
+
+            // fast path: complete top-level node inside this chunk is parsed without buffering
+            Parser parser( pos, end, pos );
+            Parser::ShallowNode node;
+            if( parser.next( node ) && static_cast<size_t>( node.encoded_end - pos ) <= _max_record_size )
+            {
+                _record_offset = _offset;
+                _tag = node.tag.value();
+                _length = node.end - node.begin;
+                Status s = _emit( pos, node.end );
+                if( !s )
+                {
+                    return s;
+                }
+                _offset += node.encoded_end - pos;
+                pos = node.encoded_end;
+                continue;
+            }
+
+            // slow path: node is split across chunks, decode header bytewise
+            _record_offset = _offset;
+            _record.clear();
+            _tag = *pos;
+            _tag_size = 1;
+            _length = 0;
+            _state = ( ( *pos & multi_octet_tag_mask ) == multi_octet_tag_mask ) ? State::TagNext : State::Length;
+            _record.push_back( *pos++ );
+            _offset++;
+        }
+        else if( _state == State::TagNext )
+        {
+            uint8_t byte = *pos;
+            _tag = ( _tag << 8 ) + byte;
+            _tag_size++;
+            _record.push_back( *pos++ );
+            _offset++;
+
+            if( !( byte & more_octet_mask ) )
+            {
+                _state = State::Length;
+            }
+            else if( _tag_size == sizeof( uint32_t ) )
+            {
+                return _fail( Status( Status::BadLength, _offset,
+                    "Tag too long while reading tag '%X' at offset %d", _tag, static_cast<int>( _offset ) ) );
+            }
+        }
+        else if( _state == State::Length )
+        {
+            uint8_t byte = *pos;
+            _record.push_back( *pos++ );
+            _offset++;
+
+            if( byte == more_octet_mask )
+            {
+                if( !Tag( _tag ).constructed() )
+                    return _fail( Status( Status::BadLength, _offset,
+                        "Indefinite length of primitive tag '%X' at offset %d", _tag, static_cast<int>( _offset ) ) );
+                _eoc_pos = 0;
+                _eoc_depth = 1;
+                _state = State::Contents;
+            }
+            else if( byte & more_octet_mask )
+            {
+                _length_size = byte ^ more_octet_mask;
+                if( _length_size > sizeof( _length ) )
+                    return _fail( Status( Status::BadLength, _offset,
+                        "Tag length of tag '%X' too large at offset %d", _tag, static_cast<int>( _offset ) ) );
+                _state = _length_size > 0 ? State::LengthNext : State::Value;
+            }
+            else
+            {
+                _length = byte;
+                _state = State::Value;
+            }
+            _header_size = _record.size();
+        }
+        else if( _state == State::LengthNext )
+        {
+            _length = ( _length << 8 ) + *pos;
+            _record.push_back( *pos++ );
+            _offset++;
+
+            if( --_length_size == 0 )
+            {
+                _state = State::Value;
+                _header_size = _record.size();
+            }
+        }
+
+        if( _state == State::Value )
+        {
+            if( _header_size + _length > _max_record_size )
+            {
+                return _fail( Status( Status::BadLength, _offset,
+                    "Length of tag '%X' exceeds maximum record size at offset %d", _tag, static_cast<int>( _offset ) ) );
+            }
+
+            // copy available value bytes in bulk
+            size_t missing = _length - ( _record.size() - _header_size );
+            size_t available = std::min<size_t>( missing, end - pos );
+            _record.insert( _record.end(), pos, pos + available );
+            pos += available;
+            _offset += available;
+
+            if( available == missing )
+            {
+                Status s = _emit( _record.data(), _record.data() + _record.size() );
+                if( !s )
+                {
+                    return s;
+                }
+            }
+        }
+        else if( _state == State::Contents )
+        {
+            // buffer available bytes, scanning resumes where the previous chunk ended
+            size_t room = _record.size() < _max_record_size ? _max_record_size - _record.size() : 0;
+            size_t available = std::min<size_t>( end - pos, room );
+            _record.insert( _record.end(), pos, pos + available );
+
+            EocMatcher matcher( _eoc_pos, _eoc_depth );
+            auto result = matcher.scan( _record.data() + _header_size, _record.size() - _header_size );
+            if( result == EocMatcher::Malformed )
+            {
+                return _fail( Status( Status::BadLength, _record_offset + _header_size + matcher.position(),
+                    "Malformed content of indefinite length tag '%X' at offset %d", _tag,
+                    static_cast<int>( _record_offset + _header_size + matcher.position() ) ) );
+            }
+            if( result == EocMatcher::NeedMore )
+            {
+                if( available < static_cast<size_t>( end - pos ) )
+                {
+                    return _fail( Status( Status::BadLength, _offset + available,
+                        "Length of tag '%X' exceeds maximum record size at offset %d", _tag, static_cast<int>( _offset + available ) ) );
+                }
+                _eoc_pos = matcher.position();
+                _eoc_depth = matcher.depth();
+                pos += available;
+                _offset += available;
+                continue;
+            }
+
+            // bytes after the end-of-contents belong to the next node
+            size_t used = available - ( _record.size() - ( _header_size + matcher.position() + eoc_size ) );
+            pos += used;
+            _offset += used;
+            _length = matcher.position();
+            Status s = _emit( _record.data(), _record.data() + _header_size + _length );
+            if( !s )
+            {
+                return s;
+            }
+        }
+    }
+
+    Status s;
+    s.set_parsed_len( _offset );
+    return s;
+}
+
+/*
+ * Writer
+ */
+
+Tlv::Writer::Writer( std::vector<uint8_t>& out, Form form ) :
+    _out( &out ),
+    _file( nullptr ),
+    _form( form ),
+    _written( 0 )
+{}
+
+Tlv::Writer::Writer( std::FILE* file, Form form ) :
+    _out( nullptr ),
+    _file( file ),
+    _form( form == Compact ? Reserved : form ),
+    _written( 0 )
+{}
+
+Tlv::Status Tlv::Writer::_fail( Status status )
+{
+    _status = std::move( status );
+    return _status;
+}
+
+Tlv::Status Tlv::Writer::_done() const
+{
+    Status s;
+    s.set_parsed_len( _written );
+    return s;
+}
+
+Tlv::Status Tlv::Writer::_append( const uint8_t* data, size_t len )
+{
+    if( _out )
+    {
+        _out->insert( _out->end(), data, data + len );
+    }
+    else if( std::fwrite( data, 1, len, _file ) != len )
+    {
+        return _fail( Status( Status::BadArgument, _written,
+            "Write error at offset %d", static_cast<int>( _written ) ) );
+    }
+    _written += len;
+    return Status();
+}
+
+Tlv::Status Tlv::Writer::begin_constructed( const Tag tag )
+{
+    if( !_status.ok() )
+    {
+        return _status;
+    }
+    if( tag.empty() )
+    {
+        return _fail( Status( Status::BadTag, _written,
+            "Missing tag of constructed node at offset %d", static_cast<int>( _written ) ) );
+    }
+
+    // indefinite length needs no patching
+    if( _form == Indefinite )
+    {
+        uint8_t header[max_header_size];
+        size_t headerSize = write_tag( header, tag );
+        header[headerSize++] = 0x80;
+        Status s = _append( header, headerSize );
+        if( !s.ok() )
+        {
+            return s;
+        }
+        _open.push_back( Open{ tag, _written } );
+        return _done();
+    }
+
+    size_t offset;
+    if( _out )
+    {
+        offset = _out->size();
+    }
+    else
+    {
+        long pos = std::ftell( _file );
+        if( pos < 0 )
+        {
+            return _fail( Status( Status::BadArgument, _written, "Output file is not seekable" ) );
+        }
+        offset = pos;
+    }
+
+    // length is not known yet, reserve the largest length field
+    uint8_t header[max_header_size];
+    size_t headerSize = write_tag( header, tag );
+    write_reserved_len( header + headerSize, 0 );
+    headerSize += reserved_len_field_size;
+
+    Status s = _append( header, headerSize );
+    if( !s.ok() )
+    {
+        return s;
+    }
+    _open.push_back( Open{ tag, offset } );
+    return _done();
+}
+
+Tlv::Status Tlv::Writer::primitive( const Tag tag, ByteSpan value )
+{
+    if( !_status.ok() )
+    {
+        return _status;
+    }
+    if( tag.empty() )
+    {
+        return _fail( Status( Status::BadTag, _written,
+            "Missing tag of primitive node at offset %d", static_cast<int>( _written ) ) );
+    }
+    if( value.size() > std::numeric_limits<uint32_t>::max() )
+    {
+        return _fail( Status( Status::BadLength, _written,
+            "Value of tag '%X' too large at offset %d", tag.value(), static_cast<int>( _written ) ) );
+    }
+
+    uint8_t header[max_header_size];
+    Status s = _append( header, write_header( header, tag, value.size() ) );
+    if( s.ok() )
+    {
+        s = _append( value.data(), value.size() );
+    }
+    return s.ok() ? _done() : s;
+}
+
+Tlv::Status Tlv::Writer::end_constructed()
+{
+    if( !_status.ok() )
+    {
+        return _status;
+    }
+    if( _open.empty() )
+    {
+        return _fail( Status( Status::BadArgument, _written,
+            "No open constructed node at offset %d", static_cast<int>( _written ) ) );
+    }
+
+    const Open node = _open.back();
+    _open.pop_back();
+    if( _form == Indefinite )
+    {
+        static const uint8_t eoc[eoc_size] = { 0, 0 };
+        Status s = _append( eoc, eoc_size );
+        return s.ok() ? _done() : s;
+    }
+
+    const size_t lengthOffset = node.header_offset + node.tag.size();
+    const size_t valueOffset = lengthOffset + reserved_len_field_size;
+
+    if( _out )
+    {
+        const size_t len = _out->size() - valueOffset;
+        if( len > std::numeric_limits<uint32_t>::max() )
+        {
+            return _fail( Status( Status::BadLength, _written,
+                "Length of tag '%X' too large at offset %d", node.tag.value(), static_cast<int>( _written ) ) );
+        }
+        if( _form != Compact )
+        {
+            write_reserved_len( _out->data() + lengthOffset, len );
+            return _done();
+        }
+
+        // move content toward the minimal header
+        const size_t headerSize = header_size( node.tag, len );
+        const size_t shift = valueOffset - node.header_offset - headerSize;
+        if( shift > 0 )
+        {
+            std::copy( _out->begin() + valueOffset, _out->end(), _out->begin() + valueOffset - shift );
+            _out->resize( _out->size() - shift );
+            _written -= shift;
+        }
+        write_header( _out->data() + node.header_offset, node.tag, len );
+        return _done();
+    }
+
+    // file output keeps the reserved length field, patch it in place
+    long end = std::ftell( _file );
+    if( end < 0 || static_cast<size_t>( end ) < valueOffset )
+    {
+        return _fail( Status( Status::BadArgument, _written, "Output file position changed unexpectedly" ) );
+    }
+    const size_t len = end - valueOffset;
+    if( len > std::numeric_limits<uint32_t>::max() )
+    {
+        return _fail( Status( Status::BadLength, _written,
+            "Length of tag '%X' too large at offset %d", node.tag.value(), static_cast<int>( _written ) ) );
+    }
+
+    uint8_t field[reserved_len_field_size];
+    write_reserved_len( field, len );
+    if( std::fseek( _file, lengthOffset, SEEK_SET ) != 0 ||
+        std::fwrite( field, 1, sizeof( field ), _file ) != sizeof( field ) ||
+        std::fseek( _file, end, SEEK_SET ) != 0 )
+    {
+        return _fail( Status( Status::BadArgument, _written,
+            "Write error while closing tag '%X' at offset %d", node.tag.value(), static_cast<int>( _written ) ) );
+    }
+    return _done();
+}
+
+Tlv::Status Tlv::Writer::finish()
+{
+    if( !_status.ok() )
+    {
+        return _status;
+    }
+    if( !_open.empty() )
+    {
+        return Status( Status::BadArgument, _written,
+            "%d constructed nodes not closed", static_cast<int>( _open.size() ) );
+    }
+    if( _file && std::fflush( _file ) != 0 )
+    {
+        return _fail( Status( Status::BadArgument, _written, "Write error while flushing output file" ) );
+    }
+    return _done();
+}
+
+template< typename Sink >
+void Tlv::_write( Sink sink ) const
+{
+    // Sizes of all nodes are cached, write headers and values in dfs order.
+    // Headers are passed in a temporary buffer, values reference the tree (last argument is true).
+    _payload_size( data_.get() );
+
+    uint8_t header[max_header_size];
+    auto write = [&]( const Data* node )
+    {
+        // unchanged parsed nodes are copied with their children from the source, which the tree keeps alive
+        if( node->source_id )
+        {
+            sink( node->encoded(), node->encoded_size, true );
+            return false;
+        }
+        size_t headerSize = write_header( header, node->tag, node->payload_size.load( std::memory_order_relaxed ) );
+        if( headerSize > 0 )
+        {
+            sink( header, headerSize, false );
+        }
+        if( !node->value.empty() )
+        {
+            sink( node->value.data(), node->value.size(), true );
+        }
+        return !node->children.empty();
+    };
+
+    struct Frame
+    {
+        const Data* node;
+        size_t child;       // next child to write
+    };
+
+    InlineStack<Frame, 16> stack;
+    if( write( data_.get() ) )
+    {
+        stack.push_back( Frame{ data_.get(), 0 } );
+    }
+
+    while( !stack.empty() )
+    {
+        Frame& frame = stack.back();
+        if( frame.child < frame.node->children.size() )
+        {
+            const Data* child = frame.node->children[frame.child++].data_.get();
+            if( write( child ) )
+            {
+                stack.push_back( Frame{ child, 0 } );
+            }
+        }
+        else
+        {
+            stack.pop_back();
+        }
+    }
+}
+
+std::vector<uint8_t> Tlv::dump() const
+{
+    std::vector<uint8_t> output;
+    dump_append( output );
+    return output;
+}
+
+size_t Tlv::dump_append( std::vector<uint8_t>& out ) const
+{
+    const size_t size = encoded_size();
+    out.reserve( out.size() + size );
+    _write( [&]( const uint8_t* data, size_t len, bool ) { out.insert( out.end(), data, data + len ); } );
+    return size;
+}
+
+size_t Tlv::dump_into( uint8_t* dst, size_t cap ) const
+{
+    const size_t size = encoded_size();
+    if( size <= cap )
+    {
+        _write( [&]( const uint8_t* data, size_t len, bool ) { std::copy( data, data + len, dst ); dst += len; } );
+    }
+    return size;
+}
+
+Tlv::GatherList Tlv::dump_gather( size_t copy_threshold ) const
+{
+    GatherList list;
+    list._size = encoded_size();
+
+    // Copied segments are recorded without data pointer, the scratch buffer may still grow
+    _write( [&]( const uint8_t* data, size_t len, bool stable )
+    {
+        if( stable && len > copy_threshold )
+        {
+            list._segments.emplace_back( data, len );
+            return;
+        }
+        list._scratch.insert( list._scratch.end(), data, data + len );
+        if( !list._segments.empty() && list._segments.back().data() == nullptr )
+        {
+            len += list._segments.back().size();
+            list._segments.pop_back();
+        }
+        list._segments.emplace_back( nullptr, len );
+    } );
+
+    size_t offset = 0;
+    for( ByteSpan& segment : list._segments )
+    {
+        if( segment.data() == nullptr )
+        {
+            segment = ByteSpan( list._scratch.data() + offset, segment.size() );
+            offset += segment.size();
+        }
+    }
+    return list;
+}
+
+std::vector<uint8_t> Tlv::GatherList::to_vector() const
+{
+    std::vector<uint8_t> output;
+    output.reserve( _size );
+    for( const ByteSpan& segment : _segments )
+    {
+        output.insert( output.end(), segment.begin(), segment.end() );
+    }
+    return output;
+}
+
+void Tlv::_dump( void (*write)( void* context, const uint8_t* data, size_t len ), void* context ) const
+{
+    _write( [&]( const uint8_t* data, size_t len, bool ) { write( context, data, len ); } );
+}
+
+std::vector<uint8_t> Tlv::dump_reverse() const
+{
+    /* Post-order walk from the last child to the first. Children are written before the value and header
+     * of their parent, so the length of the parent is the number of bytes written since it was entered. */
+    struct Frame
+    {
+        const Data* node;
+        size_t child;       // children left to write, written from the last one
+        size_t mark;        // output size when the node was entered
+    };
+
+    if( data_->source_id )
+    {
+        return std::vector<uint8_t>( data_->encoded(), data_->encoded() + data_->encoded_size );
+    }
+
+    ReverseBuffer output( 256 );
+    uint8_t header[max_header_size];
+
+    InlineStack<Frame, 16> stack;
+    stack.push_back( Frame{ data_.get(), data_->children.size(), 0 } );
+
+    while( !stack.empty() )
+    {
+        Frame& frame = stack.back();
+        if( frame.child > 0 )
+        {
+            const Data* child = frame.node->children[--frame.child].data_.get();
+            if( child->source_id )
+            {
+                output.prepend( child->encoded(), child->encoded_size );
+            }
+            else
+            {
+                stack.push_back( Frame{ child, child->children.size(), output.size() } );
+            }
+            continue;
+        }
+
+        // length as in dump, the value of a branch node is written but not counted
+        const Data* node = frame.node;
+        size_t len = node->children.empty() ? node->value.size() : output.size() - frame.mark;
+        output.prepend( node->value.data(), node->value.size() );
+        output.prepend( header, write_header( header, node->tag, len ) );
+        stack.pop_back();
+    }
+
+    return output.release();
+}
+
+size_t Tlv::encoded_size() const
+{
+    if( data_->source_id )
+    {
+        return data_->encoded_size;
+    }
+    const size_t payloadSize = _payload_size( data_.get() );
+    return header_size( data_->tag, payloadSize ) + payloadSize;
+}
+
+size_t Tlv::_payload_size( const Data* root )
+{
+    /* Post-order walk that only descends into changed nodes, unchanged subtrees contribute their cached size.
+     * Leaf nodes encode their value, branch nodes their children. */
+    size_t cached = root->payload_size.load( std::memory_order_relaxed );
+    if( cached != Data::no_size )
+    {
+        return cached;
+    }
+
+    struct Frame
+    {
+        const Data* node;
+        size_t child;       // next child to add
+        size_t size;        // size of added children
+    };
+
+    InlineStack<Frame, 16> stack;
+    stack.push_back( Frame{ root, 0, 0 } );
+
+    while( true )
+    {
+        Frame& frame = stack.back();
+        const auto& children = frame.node->children;
+        if( frame.child < children.size() )
+        {
+            const Data* child = children[frame.child++].data_.get();
+            size_t childSize = child->payload_size.load( std::memory_order_relaxed );
+            if( child->source_id )
+            {
+                frame.size += child->encoded_size;
+            }
+            else if( childSize == Data::no_size )
+            {
+                stack.push_back( Frame{ child, 0, 0 } );
+            }
+            else
+            {
+                frame.size += header_size( child->tag, childSize ) + childSize;
+            }
+            continue;
+        }
+
+        const Data* node = frame.node;
+        size_t payloadSize = children.empty() ? node->value.size() : frame.size;
+        node->payload_size.store( payloadSize, std::memory_order_relaxed );
+        stack.pop_back();
+
+        if( stack.empty() )
+        {
+            return payloadSize;
+        }
+        stack.back().size += header_size( node->tag, payloadSize ) + payloadSize;
+    }
+}
+
+uint64_t Tlv::_hash( const Data* root )
+{
+    /* Merkle hash: leaf nodes hash their tag and value, branch nodes their tag and the hashes of their
+     * children. Like the size, it is computed post-order for changed nodes only. */
+    auto mix = []( uint64_t h )
+    {
+        h = ( h ^ ( h >> 30 ) ) * 0xBF58476D1CE4E5B9ull;
+        h = ( h ^ ( h >> 27 ) ) * 0x94D049BB133111EBull;
+        return h ^ ( h >> 31 );
+    };
+    auto finish = [&]( const Data* node, uint64_t h )
+    {
+        if( node->children.empty() )
+        {
+            std::string_view bytes( reinterpret_cast<const char*>( node->value.data() ), node->value.size() );
+            h = mix( h ^ std::hash<std::string_view>()( bytes ) );
+        }
+        h = h == Data::no_hash ? 1 : h;
+        node->subtree_hash.store( h, std::memory_order_relaxed );
+        return h;
+    };
+
+    uint64_t cached = root->subtree_hash.load( std::memory_order_relaxed );
+    if( cached != Data::no_hash )
+    {
+        return cached;
+    }
+
+    struct Frame
+    {
+        const Data* node;
+        size_t child;       // next child to add
+        uint64_t hash;      // hash of tag and added children
+    };
+
+    InlineStack<Frame, 16> stack;
+    stack.push_back( Frame{ root, 0, mix( root->tag.value() ) } );
+
+    while( true )
+    {
+        Frame& frame = stack.back();
+        const auto& children = frame.node->children;
+        if( frame.child < children.size() )
+        {
+            const Data* child = children[frame.child++].data_.get();
+            uint64_t childHash = child->subtree_hash.load( std::memory_order_relaxed );
+            if( childHash == Data::no_hash )
+            {
+                stack.push_back( Frame{ child, 0, mix( child->tag.value() ) } );
+            }
+            else
+            {
+                frame.hash = mix( frame.hash ^ childHash );
+            }
+            continue;
+        }
+
+        uint64_t hash = finish( frame.node, frame.hash );
+        stack.pop_back();
+
+        if( stack.empty() )
+        {
+            return hash;
+        }
+        stack.back().hash = mix( stack.back().hash ^ hash );
+    }
+}
+
+size_t Tlv::hash() const
+{
+    return _hash( data_.get() );
+}
+
+TlvSnapshot Tlv::snapshot() const
+{
+    return TlvSnapshot( Tlv( DataRef( data_->copy( false ) ) ) );
+}
+
+Tlv Tlv::clone( std::pmr::memory_resource* resource ) const
+{
+    // the block holds all nodes, and the values and child lists that are not stored in their node
+    size_t size = 0;
+    InlineStack<const Data*, 16> pending;
+    pending.push_back( data_.get() );
+    while( !pending.empty() )
+    {
+        const Data* node = pending.back();
+        pending.pop_back();
+        size += CloneResource::block_size( sizeof( Data ) );
+        if( node->value.size() > Value::inline_capacity )
+        {
+            size += CloneResource::block_size( node->value.size() );
+        }
+        if( node->children.size() > ChildContainer::inline_capacity )
+        {
+            size += CloneResource::block_size( node->children.size() * sizeof( Tlv ) );
+        }
+        for( auto& child : node->children )
+        {
+            pending.push_back( child.data_.get() );
+        }
+    }
+
+    CloneResource* block = CloneResource::create( resource ? resource : std::pmr::get_default_resource(), size );
+    auto copy = [block]( const Data* node )
+    {
+        Data* data = Data::create( block );
+        data->tag = node->tag;
+        data->value.assign( node->value.begin(), node->value.end() );
+        data->children.reserve( node->children.size() );
+        data->payload_size.store( node->payload_size.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+        data->subtree_hash.store( node->subtree_hash.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+        if( node->source_id )
+        {
+            SourceTable::instance().retain( node->source_id, 1 );
+            data->source_id = node->source_id;
+            data->encoded_offset = node->encoded_offset;
+            data->encoded_size = node->encoded_size;
+        }
+        return data;
+    };
+
+    Tlv root( DataRef( copy( data_.get() ) ) );
+    InlineStack<std::pair<const Data*, Data*>, 16> open;
+    open.push_back( { data_.get(), root.data_.get() } );
+    while( !open.empty() )
+    {
+        auto [from, to] = open.back();
+        open.pop_back();
+        for( auto& child : from->children )
+        {
+            Data* data = copy( child.data_.get() );
+            to->append( Tlv( DataRef( data ) ) );
+            if( !child.data_->children.empty() )
+            {
+                open.push_back( { child.data_.get(), data } );
+            }
+        }
+    }
+    return root;
+}
+
+Tlv::Data* Tlv::_unshare( Data* node )
+{
+    while( node->forward )
+    {
+        node = node->forward.get();
+    }
+    // path from the node up to the topmost shared node
+    InlineStack<Data*, 16> path;
+    size_t top = 0;
+    for( Data* p = node; p; p = p->parent )
+    {
+        path.push_back( p );
+        if( p->shared() )
+        {
+            top = path.size();
+        }
+    }
+    while( path.size() > top )
+    {
+        path.pop_back();
+    }
+
+    /* Shared nodes are replaced top down, so that each copy takes the place of the node in its
+     * unshared parent. The copies adopt the children, the next node of the path among them. */
+    while( !path.empty() )
+    {
+        Data* original = path.back();
+        path.pop_back();
+        Data* parent = original->parent;
+        DataRef copy( original->copy( true ) );
+        copy->parent = parent;
+        original->forward = copy;
+        if( parent )
+        {
+            parent->replace_at( parent->index_of( original ), copy );
+        }
+        node = copy.get();
+    }
+    return node;
+}
+
+void Tlv::_unshare()
+{
+    Data* node = _unshare( data_.get() );
+    if( node != data_.get() )
+    {
+        data_ = DataRef( node );
+    }
+}
+
+void Tlv::_resolve()
+{
+    if( data_->forward )
+    {
+        Data* node = data_.get();
+        while( node->forward )
+        {
+            node = node->forward.get();
+        }
+        data_ = DataRef( node );
+    }
+}
+
+void Tlv::_invalidate( Data* node )
+{
+    /* Unchanged nodes only have unchanged descendants, so marking can stop at the first changed ancestor.
+     * Parsed nodes start without cached size, but are unchanged as long as they have their source encoding. */
+    for( ; node && ( node->payload_size.load( std::memory_order_relaxed ) != Data::no_size || node->source_id ||
+                     node->subtree_hash.load( std::memory_order_relaxed ) != Data::no_hash ); node = node->parent )
+    {
+        node->payload_size.store( Data::no_size, std::memory_order_relaxed );
+        node->subtree_hash.store( Data::no_hash, std::memory_order_relaxed );
+        node->drop_encoding();
+    }
+}
+
+std::string Tlv::dump_formatted() const
+{
+    std::string output;
+
+    auto is_printable_char = []( uint8_t byte )
+    {
+        // space ' ' 0x20 to tilde '~' 0x7E
+        return byte >= 0x20 && byte <= 0x7E;
+    };
+
+    // skip encoding of root node, if it's just a container for child nodes
+    bool skip_root = !has_tag();
+
+    // encoding of one line, in dfs order
+    auto append_node = [&]( const Tlv& tlv, int depth )
+    {
+        if( depth == 0 && skip_root )
+            return Continue;
+
+        output.append( (depth - skip_root) *4, ' ' );
+        output.append( tlv.data_->tag.to_hex_string() );
+        if( tlv.data_->value.size() > 0 )
+        {
+            output.append( " " );
+            output.append( hexify( tlv.data_->value.data(), tlv.data_->value.size() ) );
+
+            // add ascii representation as comment, if printable
+            if( std::all_of( tlv.data_->value.begin(), tlv.data_->value.end(), is_printable_char ) )
+            {
+                output.append( " // \"" );
+                output.append( tlv.string() );
+                output.append( "\"");
+            }
+        }
+        output.append( "\n" );
+
+        return TraversalAction::Continue;
+    };
+
+    _dfs_unsafe_depth( append_node );
+    return output;
+}
+
+// Capacity
+
+bool Tlv::empty() const
+{
+    return !data_ || data_->empty();
+}
+
+bool Tlv::has_tag() const
+{
+    return !data_->tag.empty();
+}
+
+bool Tlv::has_value() const
+{
+    return !data_->value.empty();
+}
+
+size_t Tlv::value_size() const
+{
+    return data_->value.size();
+}
+
+bool Tlv::has_parent() const
+{
+    return data_->parent != nullptr;
+}
+
+bool Tlv::has_children() const
+{
+    return !data_->children.empty();
+}
+
+size_t Tlv::num_children() const
+{
+    return data_->children.size();
+}
+
+size_t Tlv::tree_size() const
+{
+    size_t size = 0;
+    _dfs_unsafe( [&]( const Tlv& ){ ++size; return Continue; } );
+    return size;
+}
+
+Tlv::ChildIterator Tlv::begin()
+{
+    // children may be reordered through iterators
+    _unshare();
+    _invalidate( data_.get() );
+    data_->drop_index();
+    return data_->children.begin();
+}
+
+Tlv::ChildIterator Tlv::end()
+{
+    _unshare();
+    _invalidate( data_.get() );
+    return data_->children.end();
+}
+
+// Element access
+
+Tlv::Tag Tlv::tag() const
+{
+    return data_->tag;
+}
+
+const Tlv::Value& Tlv::value() const
+{
+    return data_->value;
+}
+
+Tlv::Value& Tlv::value()
+{
+    _unshare();
+    _invalidate( data_.get() );
+    return data_->value;
+}
+
+std::string Tlv::string() const
+{
+    return std::string( (const char*)data_->value.data(), data_->value.size() );
+}
+
+bool Tlv::boolean() const
+{
+    return std::any_of( data_->value.begin(), data_->value.end(), [](uint8_t byte) {
+        return byte != 0x00;
+    } );
+}
+
+int8_t Tlv::int8() const
+{
+    return read_int_value_raw<int8_t>( data_->value );
+}
+
+int16_t Tlv::int16() const
+{
+    return read_int_value_raw<int16_t>( data_->value );
+}
+
+int32_t Tlv::int32() const
+{
+    return read_int_value_raw<int32_t>( data_->value );
+}
+
+int64_t Tlv::int64() const
+{
+    return read_int_value_raw<int64_t>( data_->value );
+}
+
+uint8_t Tlv::uint8() const
+{
+    return read_int_value_raw<uint8_t>( data_->value );
+}
+
+uint16_t Tlv::uint16() const
+{
+    return read_int_value_raw<uint16_t>( data_->value );
+}
+
+uint32_t Tlv::uint32() const
+{
+    return read_int_value_raw<uint32_t>( data_->value );
+}
+
+uint64_t Tlv::uint64() const
+{
+    return read_int_value_raw<uint64_t>( data_->value );
+}
+
+const Tlv::ChildContainer& Tlv::children() const
+{
+    return data_->children;
+}
+
+Tlv Tlv::front() const
+{
+    return ( data_ && !data_->children.empty() ) ? Tlv( data_->children.front() ) : Tlv();
+}
+
+Tlv Tlv::back() const
+{
+    return ( data_ && !data_->children.empty() ) ? Tlv( data_->children.back() ) : Tlv();
+}
+
+void Tlv::set_value( const Value& value )
+{
+    _unshare();
+    _invalidate( data_.get() );
+    data_->value = value;
+    data_->clear_children();
+}
+void Tlv::set_value( Value&& value )
+{
+    _unshare();
+    _invalidate( data_.get() );
+    data_->value = std::move(value);
+    data_->clear_children();
+}
+
+void Tlv::set_value( const std::vector<uint8_t>& value )
+{
+    _unshare();
+    _invalidate( data_.get() );
+    data_->value.assign( value.begin(), value.end() );
+    data_->clear_children();
+}
+
+void Tlv::set_tag( const Tag& tag )
+{
+    _unshare();
+    // own payload is unchanged, but the encoded size in the parent
+    _invalidate( data_->parent );
+    data_->subtree_hash.store( Data::no_hash, std::memory_order_relaxed );
+    if( Data* parent = data_->parent )
+    {
+        parent->drop_index();
+    }
+    data_->drop_encoding();
+    data_->tag = tag;
+}
+
+void Tlv::dfs( std::function<TraversalAction(Tlv&)> callback ) const
+{
+    if ( !callback )
+    {
+        return;
+    }
+
+    std::vector<Tlv> stack;
+    stack.reserve( 4 );	 // start with a reasonable default size
+    stack.push_back( *this );
+
+    while( !stack.empty() )
+    {
+        Tlv currentNode( std::move( stack.back() ) );
+        stack.pop_back();
+
+        // visit node
+        auto ret = callback( currentNode );
+        switch( ret )
+        {
+            case Break: return;		// stop here
+            case Prune: continue;   // continue, but skip subtree of current node
+            case Continue: ;		// continue traversal
+        }
+        stack.insert( stack.end(), currentNode.data_->children.rbegin(), currentNode.data_->children.rend() );
+    }
+}
+
+void Tlv::dfs( std::function<TraversalAction(Tlv&, int depth)> callback ) const
+{
+    if ( !callback )
+    {
+        return;
+    }
+
+    // track depth of node on stack
+    std::vector<std::pair<Tlv, int>> stack;
+    stack.reserve( 4 );	 // start with a reasonable default size
+    stack.emplace_back(std::make_pair(*this, 0));
+
+    while( !stack.empty() )
+    {
+        auto nodeElement( std::move( stack.back() ) );
+        stack.pop_back();
+
+        // visit node
+        auto ret = callback( nodeElement.first, nodeElement.second );
+        switch( ret )
+        {
+            case Break: return;		// stop here
+            case Prune: continue;   // continue, but skip subtree of current node
+            case Continue: ;		// continue traversal
+        }
+
+        auto& children = nodeElement.first.data_->children;
+        for( auto it = children.rbegin(); it != children.rend(); ++it )
+        {
+            stack.emplace_back(*it, nodeElement.second +1 );
+        }
+    }
+}
+
+void Tlv::bfs( std::function<TraversalAction(Tlv&)> callback ) const
+{
+    if ( !callback )
+    {
+        return;
+    }
+
+    std::deque<Tlv> queue;
+    queue.push_back( *this );
+
+    while( !queue.empty() )
+    {
+        Tlv currentNode( std::move( queue.front() ) );
+        queue.pop_front();
+
+        // visit node
+        auto ret = callback( currentNode );
+        switch( ret )
+        {
+            case Break: return;		// stop here
+            case Prune: continue;   // continue, but skip subtree of current node
+            case Continue: ;		// continue traversal
+        }
+
+        // add children of current node to queue
+        queue.insert( queue.end(), currentNode.data_->children.begin(), currentNode.data_->children.end() );
+    }
+}
+
+void Tlv::bfs( std::function<TraversalAction(Tlv&, int depth)> callback ) const
+{
+    if ( !callback )
+    {
+        return;
+    }
+
+    // track depth of node in queue
+    std::deque<std::pair<Tlv, int>> queue;
+    queue.emplace_back(std::make_pair(*this, 0));
+
+    while( !queue.empty() )
+    {
+        auto nodeElement( std::move( queue.back() ) );
+        queue.pop_back();
+
+        // visit node
+        auto ret = callback( nodeElement.first, nodeElement.second );
+        switch( ret )
+        {
+            case Break: return;		// stop here
+            case Prune: continue;   // continue, but skip subtree of current node
+            case Continue: ;		// continue traversal
+        }
+
+        auto& children = nodeElement.first.data_->children;
+        for( auto it = children.rbegin(); it != children.rend(); ++it )
+        {
+            queue.emplace_back(*it, nodeElement.second +1 );
+        }
+    }
+}
+
+Tlv Tlv::find( const Tag tag, int maxDepth ) const
+{
+    // just iterate to find direct childen
+    if( maxDepth == DirectChildren )
+    {
+        if( auto index = data_->find_index() )
+        {
+            auto it = index->find( tag.value() );
+            return it != index->end() ? Tlv( DataRef( it->second.front() ) ) : Tlv();
+        }
+
+        for( auto& child : data_->children )
+        {
+            if( child.tag() == tag )
+            {
+                return child;
+            }
+        }
+
+        return Tlv();
+    }
+    // dfs search to find first deep match
+    else
+    {
+        Tlv tlv;
+        auto find_tag = [&]( const Tlv& child, int depth )
+        {
+            if( child.tag() == tag )
+            {
+                tlv = child;
+                return TraversalAction::Break;
+            }
+            else if( depth == maxDepth )
+            {
+                return TraversalAction::Prune;
+            }
+            else
+            {
+                return TraversalAction::Continue;
+            }
+        };
+
+        _dfs_unsafe_depth( find_tag );
+        return tlv;
+    }
+}
+
+std::vector<Tlv> Tlv::find_all( const Tag tag, int maxDepth, bool findNested ) const
+{
+    std::vector<Tlv> matches;
+
+    // just iterate to find direct childen
+    if( maxDepth == DirectChildren )
+    {
+        if( auto index = data_->find_index() )
+        {
+            auto it = index->find( tag.value() );
+            if( it != index->end() )
+            {
+                matches.reserve( it->second.size() );
+                for( Data* child : it->second )
+                {
+                    matches.push_back( Tlv( DataRef( child ) ) );
+                }
+            }
+            return matches;
+        }
+
+        for( auto& child : data_->children )
+        {
+            if( child.tag() == tag )
+            {
+                matches.push_back( child );
+            }
+        }
+    }
+    // dfs search to find deep matches
+    else
+    {
+        auto find_tag = [&]( const Tlv& child, int depth )
+        {
+            bool match = child.tag() == tag;
+            if( match )
+            {
+                matches.push_back( child );
+            }
+
+            if( ( match && !findNested ) || depth == maxDepth )
+            {
+                return TraversalAction::Prune;
+            }
+            else
+            {
+                return TraversalAction::Continue;
+            }
+        };
+
+        _dfs_unsafe_depth( find_tag );
+    }
+    return matches;
+}
+
+size_t Tlv::remove( const Tag tag )
+{
+    return remove_if( [tag]( const Tlv& child ) { return child.tag() == tag; } );
+}
+
+size_t Tlv::remove_if( std::function<bool(const Tlv&)> predicate )
+{
+    _unshare();
+    /* Kept children are swapped to the front in one pass, so that the list stays complete
+     * if the predicate throws. */
+    auto& children = data_->children;
+    auto kept = children.begin();
+    for( auto it = children.begin(); it != children.end(); ++it )
+    {
+        if( !predicate( *it ) )
+        {
+            if( kept != it )
+            {
+                kept->swap( *it );
+            }
+            ++kept;
+        }
+    }
+
+    size_t num = children.end() - kept;
+    if( num > 0 )
+    {
+        _invalidate( data_.get() );
+        data_->drop_index();
+        for( auto it = kept; it != children.end(); ++it )
+        {
+            it->data_->parent = nullptr;
+            it->data_->holders.fetch_sub( 1, std::memory_order_release );
+        }
+        children.erase( kept, children.end() );
+        data_->renumber( 0 );
+    }
+    return num;
+}
+
+// Modifiers
+
+void Tlv::set_parent( Tlv &parent )
+{
+    parent.push_back( *this );
+}
+
+void Tlv::push_front( Tlv &child )
+{
+    _unshare();
+    data_->value.clear();
+    child.detach();
+    _invalidate( data_.get() );
+    data_->prepend( child );
+}
+
+void Tlv::push_front( Tlv&& child )
+{
+    _unshare();
+    data_->value.clear();
+    child.detach();
+    _invalidate( data_.get() );
+    data_->prepend( std::move( child ) );
+}
+
+void Tlv::push_back( Tlv& child )
+{
+    _unshare();
+    data_->value.clear();
+    child.detach();
+    _invalidate( data_.get() );
+    data_->append( child );
+}
+
+void Tlv::push_back( Tlv&& child )
+{
+    _unshare();
+    data_->value.clear();
+    child.detach();
+    _invalidate( data_.get() );
+    data_->append( std::move( child ) );
+}
+
+void Tlv::pop_front()
+{
+    _unshare();
+    if ( !data_->children.empty() )
+    {
+        assert( data_->children.front().data_->parent == data_.get() );
+        _invalidate( data_.get() );
+        data_->remove_at( 0 );
+    }
+}
+
+void Tlv::pop_back()
+{
+    _unshare();
+    if ( !data_->children.empty() )
+    {
+        assert( data_->children.back().data_->parent == data_.get() );
+        _invalidate( data_.get() );
+        data_->remove_at( data_->children.size() - 1 );
+    }
+}
+
+void Tlv::detach()
+{
+    _resolve();
+    if ( data_->parent )
+    {
+        // this may be the handle in the child list of the parent
+        Data* node = data_.get();
+        DataRef keep( data_ );
+        Data* parent = _unshare( node->parent );
+        _invalidate( parent );
+        size_t index = parent->index_of( node );
+        /* If this node has a parent, it must be child of it's parent. */
+        assert( index < parent->children.size() );
+        parent->remove_at( index );
+    }
+}
+
+void Tlv::erase( const Tag tag )
+{
+    remove( tag );
+}
+
+void Tlv::swap( Tlv &other )
+{
+    DataRef tmp = std::move( data_ );
+    data_ = std::move( other.data_ );
+    other.data_ = std::move( tmp );
+}
+
+void Tlv::reset()
+{
+    data_ = DataRef( Data::create( std::pmr::get_default_resource() ) );
+}
+
+template< typename T >
+inline void Tlv::_dfs_unsafe( T callback ) const
+{
+    std::vector<const Tlv*> stack;
+    stack.reserve( 4 );				// start with a reasonable default size
+    stack.push_back( this );
+
+    while( !stack.empty() )
+    {
+        const Tlv* currentNode = stack.back();
+        stack.pop_back();
+
+        auto ret = callback( *currentNode );
+
+        switch( ret )
+        {
+            case Break: return;		// stop here
+            case Prune: continue;   // continue, but skip subtree of current node
+            case Continue: ;		// continue traversal
+        }
+
+        // add children of current node to stack - first child must be on top of stack
+        auto &children = currentNode->data_->children;
+        for( int r = children.size() - 1; r >= 0; r-- )
+        {
+            stack.push_back(&children[r]);
+        }
+    }
+}
+
+template< typename T >
+inline void Tlv::_dfs_unsafe_depth( T callback ) const
+{
+    std::vector<std::pair<const Tlv*, int>> stack;
+    stack.reserve( 4 );				// start with a reasonable default size
+    stack.emplace_back( this, 0 );
+
+    while( !stack.empty() )
+    {
+        auto currentElement = stack.back();
+        stack.pop_back();
+
+        auto ret = callback( *(currentElement.first), currentElement.second );
+
+        switch( ret )
+        {
+            case Break: return;		// stop here
+            case Prune: continue;   // continue, but skip subtree of current node
+            case Continue: ;		// continue traversal
+        }
+
+        // add children of current node to stack - first child must be on top of stack
+        auto &children = currentElement.first->data_->children;
+        for( int r = children.size() - 1; r >= 0; r-- )
+        {
+            stack.emplace_back(&children[r], currentElement.second + 1);
+        }
+    }
+}
+
+template< typename Visitor >
+Tlv::Status Tlv::_walk( const uint8_t* begin, const uint8_t* end, const uint8_t* tree_begin, int maxDepth, Visitor& visitor )
+{
+    /* Depth first walk over the encoded data in document order, without building nodes.
+     * The visitor is notified when a node is entered, and when an expanded constructed node is left.
+     * Only the parser state of the current branch is kept, which fits into inline storage for common depths. */
+    if( maxDepth <= 0 )
+    {
+        return Status( Status::BadArgument, begin - tree_begin, "Minimum parse depth is 1" );
+    }
+
+    struct Frame
+    {
+        Parser parser;
+        Tag tag;
+    };
+
+    Status status;
+    InlineStack<Frame, 16> stack;
+    stack.push_back( Frame{ Parser( begin, end, tree_begin ), Tag() } );
+
+    while( !stack.empty() )
+    {
+        Parser& parser = stack.back().parser;
+        int depth = stack.size();
+
+        if( !parser.has_next_tag() )
+        {
+            Tag tag = stack.back().tag;
+            stack.pop_back();
+            if( !stack.empty() )
+            {
+                visitor.leave( tag, depth - 1 );
+            }
+            continue;
+        }
+
+        const uint8_t* header = parser.position();
+        Parser::ShallowNode node;
+        status = parser.next( node );
+
+        // Abort on parse errors
+        if( !status )
+        {
+            return status;
+        }
+
+        bool expand = node.tag.constructed() && depth < maxDepth;
+        switch( visitor.enter( node, header, depth, expand ) )
+        {
+            case Break:
+                status.set_parsed_len( node.encoded_end - tree_begin );
+                return status;
+            case Prune:
+                break;
+            case Continue:
+                if( expand )
+                {
+                    stack.push_back( Frame{ Parser( node.begin, node.end, tree_begin ), node.tag } );
+                }
+        }
+    }
+
+    status.set_parsed_len( end - tree_begin );
+    return status;
+}
+
+const Tlv::Status Tlv::_parse(Tlv& root, const uint8_t* begin, const uint8_t* end, const uint8_t* tree_begin, int maxDepth, const Projection* projection,
+                              const Source* source)
+{
+    // Index the data first, nodes are only built for valid input
+    TlvTape tape;
+    Status status = tape._index( begin, end, tree_begin, maxDepth, projection );
+    if( status )
+    {
+        _build( root, tape, 0, tape.size(), source );
+    }
+    return status;
+}
+
+void Tlv::_build( Tlv& root, const TlvTape& tape, uint32_t first, uint32_t last, const Source* source )
+{
+    /* Tape entries are in document order, each node is a child of the last expanded node
+     * of the preceding depth. Child lists are sized up front by following subtree ends. */
+    auto reserve_children = [&]( Data* data, uint32_t begin, uint32_t end )
+    {
+        size_t num = 0;
+        for( uint32_t i = begin; i < end; i = tape[i].end )
+        {
+            num++;
+        }
+        data->children.reserve( data->children.size() + num );
+    };
+
+    if( first >= last )
+    {
+        return;
+    }
+
+    // nodes hold a reference to their input, that of a parsed root is shared. Offsets are 32 bit.
+    SourceTable::Id sourceId = 0;
+    if( source && ( *source )->size() <= UINT32_MAX )
+    {
+        SourceTable& table = SourceTable::instance();
+        sourceId = root.data_->source_id;
+        if( sourceId && table.input( sourceId ) == *source )
+        {
+            table.retain( sourceId, last - first );
+        }
+        else
+        {
+            sourceId = table.acquire( *source, last - first );
+        }
+    }
+
+    uint32_t baseDepth = tape[first].depth - 1;
+    InlineStack<Data*, 16> open;
+    open.push_back( root.data_.get() );
+    reserve_children( root.data_.get(), first, last );
+
+    for( uint32_t i = first; i < last; i++ )
+    {
+        const TlvTape::Entry& entry = tape[i];
+        while( open.size() > entry.depth - baseDepth )
+        {
+            open.pop_back();
+        }
+
+        Data* parent = open.back();
+        parent->append( _make( parent->children.get_allocator().resource() ) );
+        Data* childDataPtr = parent->children.back().data_.get();
+        childDataPtr->tag = entry.tag;
+        if( sourceId )
+        {
+            ByteSpan encoded = tape.encoded( i );
+            childDataPtr->source_id = sourceId;
+            childDataPtr->encoded_offset = (uint32_t)( encoded.data() - ( *source )->data() );
+            childDataPtr->encoded_size = (uint32_t)encoded.size();
+        }
+
+        // Constructed nodes within max depth are followed by their children, otherwise assign data
+        if( tape.expanded( i ) )
+        {
+            reserve_children( childDataPtr, i + 1, entry.end );
+            open.push_back( childDataPtr );
+        }
+        else
+        {
+            auto value = tape.value( i );
+            childDataPtr->value.assign( value.begin(), value.end() );
+        }
+    }
+}
+
+const Tlv::Status Tlv::_parse_one(Tlv& root, const uint8_t* begin, const uint8_t* end, const uint8_t* tree_begin, int maxDepth, const Projection* projection,
+                                  const Source* source)
+{
+    if( maxDepth <= 0 )
+    {
+        return Status( Status::BadArgument, begin - tree_begin, "Minimum parse depth is 1" );
+    }
+
+    Status s;
+    Parser parser(begin, end, tree_begin);
+    if( parser.has_next_tag() )
+    {
+        const uint8_t* header = parser.position();
+        Parser::ShallowNode shallowNode;
+        s = parser.next( shallowNode );
+
+        if( s )
+        {
+            root.data_->tag = shallowNode.tag;
+            if( source && ( *source )->size() <= UINT32_MAX )
+            {
+                root.data_->source_id = SourceTable::instance().acquire( *source, 1 );
+                root.data_->encoded_offset = (uint32_t)( header - ( *source )->data() );
+                root.data_->encoded_size = (uint32_t)( shallowNode.encoded_end - header );
+            }
+            // Root node is always kept, projection paths start with its tag
+            if( root.tag().constructed() && maxDepth -1 > 0 && projection )
+            {
+                TlvTape tape;
+                s = tape._index( header, shallowNode.encoded_end, tree_begin, maxDepth, projection );
+                if( s && !tape.empty() )
+                {
+                    _build( root, tape, 1, tape.size() );
+                }
+            }
+            // Do we neet to continue parsing children?
+            else if( root.tag().constructed() && maxDepth -1 > 0 )
+            {
+                s = _parse( root, shallowNode.begin, shallowNode.end, tree_begin, maxDepth -1, nullptr, source );
+                if( s )
+                {
+                    s.set_parsed_len( shallowNode.encoded_end - tree_begin );
                 }
             }
+            else
+            {
+                root.data_->value.assign( shallowNode.begin, shallowNode.end );
+            }
+
+        }
+    }
+
+    return s;
+}
+
+const Tlv::Status Tlv::_parse_formatted(Tlv &root, std::string_view data)
+{
+    /* Note: The formatted parser parses tags linewise, indentation defines nesting.
+     * Tags in the data-format appear in DFS order of the TLV-tree */
+    FormattedParser parser( data );
+    Tlv::Status status;
+
+    struct ParentNode
+    {
+        Data* node;
+        int   child_indent;   // indentation child tags
+    };
+
+    // The stack has the parent nodes chain
+    std::vector<ParentNode> stack;
+    stack.reserve( 4 );
+    // Virtual root node without tag number has all children (per definition they have indent >= 0)
+    stack.push_back({ root.data_.get(), -1 });
+    auto resource = root._resource();
+
+    while( parser.has_next_tag() )
+    {
+        // Parse one line / tag
+        FormattedParser::ShallowNode node;
+        status = parser.next( node );
+        if( !status.ok() )
+        {
+            return status;
+        }
+
+        // Create Tlv node for decoded ShallowNode
+        Tlv tlvNode = _make( resource );
+        tlvNode.data_->tag = node.tag;
+        if( !node.hexData.empty() )
+        {
+            tlvNode.set_value( LibtlvUtil::unhexify( node.hexData ));
         }
-        // already explored node, size is known, propagate to parent nodes
-        else
+
+        /* Assertion due to DFS-order:
+         * Each node that has child nodes, has at least one direct child tag that comes immediately after.
+         * If a non direct child requires stack-unwind, it must already have other child nodes with
+         * equal indentation */
+
+        // Case 1: Child of current parent on stack
+        if( node.indent >= stack.back().child_indent )
         {
-            if( currentElement.parentOffset > 0 )
+            // Sibling of last tag
+            if( stack.back().child_indent == node.indent )
+            {
+                stack.back().node->append( tlvNode );
+            }
+            // First child of root node (special case)
+            else if( stack.back().child_indent == -1 )
+            {
+                stack.back().child_indent = node.indent;
+                stack.back().node->append( tlvNode );
+            }
+            // Subtag of last tag,
+            else if ( node.indent > stack.back().child_indent )
             {
-                // add own size to parent size + size for tag + len field
-                auto &parentNodeNumber = buildStack[buildStack.size() - 1 - currentElement.parentOffset].nodeNumber;
+                // The last child tag of the current parent, becomes new parent for this tag
+                auto new_parent = stack.back().node->children.back().data_.get();
 
-                // this node only has a positive node size and len field if, the tag is not emtpy
-                if( !currentElement.node->tag().empty() )
+                // Enforce that parent is a constructred tag
+                if( !new_parent->tag.constructed() )
+                {
+                    status = Tlv::Status( Tlv::Status::UnexpectedData, parser.get_cur_pos(),
+                                          "Invalid subtag %X for non-construted parent tag %X on line %u",
+                                          node.tag.value(), new_parent->tag.value(), (unsigned)parser.get_cur_line()-1 );
+                    return status;
+                }
+                // Enforce that parent has no payload data
+                if( !new_parent->value.empty() )
                 {
-                    buildElements[parentNodeNumber].size
-                            += currentElement.node->tag().size()							   // tag size
-                            + len_field_size( buildElements[currentElement.nodeNumber].size ); // len field size
+                    status = Tlv::Status( Tlv::Status::UnexpectedData, parser.get_cur_pos(),
+                                          "Invalid subtag %X for parent tag %X with payload data on line %u",
+                                          node.tag.value(), new_parent->tag.value(), (unsigned)parser.get_cur_line()-1 );
+                    return status;
                 }
-                buildElements[parentNodeNumber].size += buildElements[currentElement.nodeNumber].size; // payload size
+
+                // It must be pushed on stack
+                stack.push_back( { new_parent, node.indent } );
+                // This node with bigger indentation becomes first child of new parent
+                new_parent->append( tlvNode );
             }
-            buildStack.pop_back();
         }
-    }
-
-    size_t total_size = data_->tag.size() + len_field_size( buildElements[0].size ) + buildElements[0].size;
-
-    std::vector<uint8_t> output;
-    output.reserve(total_size);
 
-    static auto build_tag = []( std::vector<uint8_t> &out, const Data &element, size_t size ) {
-        if( !element.tag.empty() )
+        // Case 2: Sibling of a previous tag on stack
+        else
         {
-            // Build tag
-            for( int i = ( sizeof( element.tag._value ) - __builtin_clz( element.tag._value ) / 8 ) - 1; i >= 0; i-- )
+            // Unwind stack until finding the correct parent
+            // Note that the root note will never be removed since it's child_indent (-1) is smaller than for any other node
+            while( stack.back().child_indent > node.indent )
             {
-                out.push_back( ( element.tag._value >> ( i * 8 ) ) & 0xFF );
+                stack.pop_back();
             }
-            // Build length
-            size_t len = size;
-            if ( len <= 127 )
+
+            // Enforce that all children of a tag use identical indentation
+            if( stack.back().child_indent != node.indent )
             {
-                // Definite short form
-                out.push_back( len & 0x7F );
-            } else {
-                // Definite long form
-                int len_bytes = 4 - __builtin_clz( len ) / 8;
-                out.push_back( (uint8_t)( 0x80 | len_bytes ) );
-                for( int i = len_bytes - 1; i >= 0; i-- )
-                {
-                    out.push_back( ( len >> ( i * 8 ) ) & 0xFF );
-                }
+                status = Tlv::Status( Tlv::Status::UnexpectedData, parser.get_cur_pos(),
+                                      "Tag %X on line %u has unexpected indentation.", node.tag.value(), (unsigned)parser.get_cur_line()-1 );
+                return status;
             }
-        }
-        // Append data
-        out.insert( out.end(), element.value.begin(), element.value.end() );
-    };
 
-
-    for( auto &el : buildElements )
-    {
-        build_tag( output, *el.node->data_, el.size );
+            // Set as child of current parent
+            stack.back().node->append( tlvNode );
+        }
     }
 
-    return output;
+    status.set_parsed_len(parser.get_cur_pos());
+    return status;
 }
 
-std::string Tlv::dump_formatted() const
+/*
+ * Scan
+ */
+
+Tlv::TraversalAction Tlv::ScanHandler::on_begin_constructed( const Tag, size_t, size_t )
 {
-    std::string output;
+    return Continue;
+}
 
-    auto is_printable_char = []( uint8_t byte )
-    {
-        // space ' ' 0x20 to tilde '~' 0x7E
-        return byte >= 0x20 && byte <= 0x7E;
-    };
+Tlv::TraversalAction Tlv::ScanHandler::on_primitive( const Tag, ByteSpan )
+{
+    return Continue;
+}
 
-    // skip encoding of root node, if it's just a container for child nodes
-    bool skip_root = !has_tag();
+void Tlv::ScanHandler::on_end_constructed( const Tag )
+{}
 
-    // encoding of one line, in dfs order
-    auto append_node = [&]( const Tlv& tlv, int depth )
+Tlv::Status Tlv::scan( const uint8_t *data, const size_t size, ScanHandler &handler, int depth )
+{
+    struct ScanVisitor
     {
-        if( depth == 0 && skip_root )
-            return Continue;
+        ScanHandler& handler;
+        const uint8_t* tree_begin;
 
-        output.append( (depth - skip_root) *4, ' ' );
-        output.append( tlv.data_->tag.to_hex_string() );
-        if( tlv.data_->value.size() > 0 )
+        TraversalAction enter( const Parser::ShallowNode& node, const uint8_t*, int, bool expand )
         {
-            output.append( " " );
-            output.append( hexify( tlv.data_->value ) );
-
-            // add ascii representation as comment, if printable
-            if( std::all_of( tlv.data_->value.begin(), tlv.data_->value.end(), is_printable_char ) )
+            if( expand )
             {
-                output.append( " // \"" );
-                output.append( tlv.string() );
-                output.append( "\"");
+                return handler.on_begin_constructed( node.tag, node.begin - tree_begin, node.end - node.begin );
             }
+            // leaf nodes can only break the scan
+            return handler.on_primitive( node.tag, ByteSpan( node.begin, node.end - node.begin ) ) == Break ? Break : Continue;
         }
-        output.append( "\n" );
 
-        return TraversalAction::Continue;
+        void leave( Tag tag, int )
+        {
+            handler.on_end_constructed( tag );
+        }
     };
 
-    _dfs_unsafe_depth( append_node );
-    return output;
+    ScanVisitor visitor{ handler, data };
+    return _walk( data, data + size, data, depth, visitor );
 }
 
-// Capacity
+/*
+ * Validate
+ */
 
-bool Tlv::empty() const
+namespace
 {
-    return !data_ || data_->empty();
+    // walk visitor that only checks the structure
+    struct ValidatingVisitor
+    {
+        template< typename Node >
+        Tlv::TraversalAction enter( const Node&, const uint8_t*, int, bool ) { return Tlv::Continue; }
+        void leave( Tlv::Tag, int ) {}
+    };
 }
 
-bool Tlv::has_tag() const
+bool Tlv::validate( const uint8_t *data, const size_t size, Status &s, int depth )
 {
-    return !data_->tag.empty();
+    ValidatingVisitor visitor;
+    s = _walk( data, data + size, data, depth, visitor );
+    return s.ok();
 }
 
-bool Tlv::has_value() const
-{
-    return !data_->value.empty();
-}
+/*
+ * Patch
+ */
 
-size_t Tlv::value_size() const
+struct Tlv::PathNode
 {
-    return data_->value.size();
-}
+    size_t length_offset;   // offset of the length field
+    size_t value_offset;
+    size_t length;          // value length
+    bool indefinite;
+};
 
-bool Tlv::has_parent() const
+Tlv::Status Tlv::_locate( const uint8_t* data, size_t size, const std::vector<Tag>& path, std::vector<PathNode>& nodes )
 {
-    return data_->parent != nullptr;
+    if( path.empty() )
+    {
+        return Status( Status::BadArgument, 0, "Empty tag path" );
+    }
+
+    const uint8_t* begin = data;
+    const uint8_t* end = data + size;
+    for( size_t level = 0; level < path.size(); level++ )
+    {
+        // siblings before the matching node are skipped by their length
+        Parser parser( begin, end, data );
+        bool found = false;
+        while( !found && parser.has_next_tag() )
+        {
+            const uint8_t* header = parser.position();
+            Parser::ShallowNode node;
+            Status s = parser.next( node );
+            if( !s )
+            {
+                return s;
+            }
+            if( node.tag == path[level] && ( level + 1 == path.size() || node.tag.constructed() ) )
+            {
+                nodes.push_back( PathNode{ static_cast<size_t>( header - data ) + node.tag.size(), static_cast<size_t>( node.begin - data ),
+                                           static_cast<size_t>( node.end - node.begin ), node.encoded_end != node.end } );
+                begin = node.begin;
+                end = node.end;
+                found = true;
+            }
+        }
+        if( !found )
+        {
+            return Status( Status::BadArgument, begin - data, "Tag '%X' of path not found at level %d",
+                           path[level].value(), static_cast<int>( level + 1 ) );
+        }
+    }
+    return Status( Status::OK, nodes.back().value_offset );
 }
 
-bool Tlv::has_children() const
+Tlv::Status Tlv::patch_value( uint8_t *data, const size_t size, const std::vector<Tag>& path, ByteSpan value )
 {
-    return !data_->children.empty();
+    std::vector<PathNode> nodes;
+    Status s = _locate( data, size, path, nodes );
+    if( !s )
+    {
+        return s;
+    }
+
+    const PathNode& target = nodes.back();
+    if( value.size() != target.length )
+    {
+        return Status( Status::BadLength, target.value_offset, "Value size %d differs from current size %d",
+                       static_cast<int>( value.size() ), static_cast<int>( target.length ) );
+    }
+    std::copy( value.begin(), value.end(), data + target.value_offset );
+    return s;
 }
 
-size_t Tlv::num_children() const
+Tlv::Status Tlv::patch_value( std::vector<uint8_t>& data, const std::vector<Tag>& path, ByteSpan value )
 {
-    return data_->children.size();
+    std::vector<PathNode> nodes;
+    Status s = _locate( data.data(), data.size(), path, nodes );
+    if( !s )
+    {
+        return s;
+    }
+
+    struct Edit
+    {
+        size_t offset;
+        size_t size;        // replaced bytes
+        const uint8_t* data;
+        size_t new_size;
+    };
+
+    /* Lengths change by the value delta plus the growth of nested length fields, from the node up.
+     * All edits grow or all shrink, since length fields keep their size when the length decreases. */
+    const PathNode& target = nodes.back();
+    std::vector<Edit> edits( nodes.size() + 1 );
+    std::vector<uint8_t> fields( nodes.size() * ( sizeof( uint32_t ) + 1 ) );
+    edits.back() = Edit{ target.value_offset, target.length, value.data(), value.size() };
+
+    const ptrdiff_t valueDelta = static_cast<ptrdiff_t>( value.size() ) - static_cast<ptrdiff_t>( target.length );
+    ptrdiff_t delta = valueDelta;
+    size_t numEdits = 1;
+    for( size_t i = nodes.size(); i-- > 0; )
+    {
+        const PathNode& node = nodes[i];
+        if( node.indefinite || delta == 0 )
+        {
+            continue;
+        }
+
+        const size_t length = node.length + delta;
+        if( length > std::numeric_limits<uint32_t>::max() )
+        {
+            return Status( Status::BadLength, node.length_offset, "Length too large at offset %d",
+                           static_cast<int>( node.length_offset ) );
+        }
+        const size_t fieldSize = node.value_offset - node.length_offset;
+        uint8_t* field = fields.data() + i * ( sizeof( uint32_t ) + 1 );
+        size_t newFieldSize = write_len_field( field, length, fieldSize );
+        if( newFieldSize == 0 )
+        {
+            newFieldSize = write_len_field( field, length, len_field_size( length ) );
+        }
+        edits[nodes.size() - numEdits++] = Edit{ node.length_offset, fieldSize, field, newFieldSize };
+        delta += static_cast<ptrdiff_t>( newFieldSize ) - static_cast<ptrdiff_t>( fieldSize );
+    }
+    edits.erase( edits.begin(), edits.end() - numEdits );
+
+    // move the bytes between edits once, from the back if the data grows
+    const size_t oldSize = data.size();
+    ptrdiff_t shift = 0;
+    auto segment_end = [&]( size_t k ) { return k + 1 < edits.size() ? edits[k + 1].offset : oldSize; };
+    if( delta > 0 )
+    {
+        data.resize( oldSize + delta );
+        shift = delta;
+        for( size_t k = edits.size(); k-- > 0; )
+        {
+            const Edit& edit = edits[k];
+            std::copy_backward( data.begin() + edit.offset + edit.size, data.begin() + segment_end( k ), data.begin() + segment_end( k ) + shift );
+            shift -= static_cast<ptrdiff_t>( edit.new_size ) - static_cast<ptrdiff_t>( edit.size );
+            std::copy( edit.data, edit.data + edit.new_size, data.begin() + edit.offset + shift );
+        }
+    }
+    else
+    {
+        for( size_t k = 0; k < edits.size(); k++ )
+        {
+            const Edit& edit = edits[k];
+            std::copy( edit.data, edit.data + edit.new_size, data.begin() + edit.offset + shift );
+            shift += static_cast<ptrdiff_t>( edit.new_size ) - static_cast<ptrdiff_t>( edit.size );
+            std::copy( data.begin() + edit.offset + edit.size, data.begin() + segment_end( k ), data.begin() + edit.offset + edit.size + shift );
+        }
+        data.resize( oldSize + delta );
+    }
+
+    s.set_parsed_len( target.value_offset + delta - valueDelta );
+    return s;
 }
 
-size_t Tlv::tree_size() const
+/*
+ * TlvSnapshot
+ */
+
+std::vector<TlvSnapshot> TlvSnapshot::children() const
 {
-    size_t size = 0;
-    _dfs_unsafe( [&]( const Tlv& ){ ++size; return Continue; } );
-    return size;
+    std::vector<TlvSnapshot> children;
+    children.reserve( _node.num_children() );
+    for( auto& child : _node.children() )
+    {
+        children.push_back( TlvSnapshot( child ) );
+    }
+    return children;
 }
 
-Tlv::ChildIterator Tlv::begin()
+TlvSnapshot TlvSnapshot::front() const
 {
-    return data_->children.begin();
+    return TlvSnapshot( _node.front() );
 }
 
-Tlv::ChildIterator Tlv::end()
+TlvSnapshot TlvSnapshot::back() const
 {
-    return data_->children.begin();
+    return TlvSnapshot( _node.back() );
 }
 
-// Element access
-
-Tlv::Tag Tlv::tag() const
+TlvSnapshot TlvSnapshot::find( const Tlv::Tag tag, int maxDepth ) const
 {
-    return data_->tag;
+    return TlvSnapshot( _node.find( tag, maxDepth ) );
 }
 
-const Tlv::Value& Tlv::value() const
+std::vector<TlvSnapshot> TlvSnapshot::find_all( const Tlv::Tag tag, int maxDepth, bool findNested ) const
 {
-    return data_->value;
+    std::vector<TlvSnapshot> nodes;
+    for( auto& node : _node.find_all( tag, maxDepth, findNested ) )
+    {
+        nodes.push_back( TlvSnapshot( node ) );
+    }
+    return nodes;
 }
 
-Tlv::Value& Tlv::value()
+/*
+ * TlvView
+ */
+
+TlvView::TlvView() :
+    _tag(),
+    _begin( nullptr ),
+    _end( nullptr ),
+    _tree_begin( nullptr ),
+    _depth( 0 ),
+    _tape( nullptr ),
+    _index( TlvTape::npos )
+{}
+
+TlvView::TlvView( Tlv::Tag tag, const uint8_t* begin, const uint8_t* end, const uint8_t* tree_begin, int depth ) :
+    _tag( tag ),
+    _begin( begin ),
+    _end( end ),
+    _tree_begin( tree_begin ),
+    _depth( depth ),
+    _tape( nullptr ),
+    _index( TlvTape::npos )
+{}
+
+TlvView::TlvView( const TlvTape* tape, uint32_t index ) :
+    _tag(),
+    _begin( tape->_data ),
+    _end( tape->_data + tape->_size ),
+    _tree_begin( tape->_data ),
+    _depth( tape->_depth ),
+    _tape( tape ),
+    _index( index )
 {
-    return data_->value;
+    if( index != TlvTape::npos )
+    {
+        const TlvTape::Entry& entry = ( *tape )[index];
+        _tag = entry.tag;
+        _begin = tape->_data + entry.value_offset;
+        _end = _begin + entry.length;
+        _depth = tape->_depth - entry.depth;
+    }
 }
 
-std::string Tlv::string() const
+TlvView TlvView::parse( const uint8_t *data, const size_t size, Tlv::Status &s, int depth )
 {
-    return std::string( (const char*)data_->value.data(), data_->value.size() );
+    if( depth <= 0 )
+    {
+        s = Tlv::Status( Tlv::Status::BadArgument, 0, "Minimum parse depth is 1" );
+        return TlvView();
+    }
+
+    s = Tlv::Status();
+    Tlv::Parser parser( data, data + size, data );
+    if( !parser.has_next_tag() )
+    {
+        return TlvView();
+    }
+
+    Tlv::Parser::ShallowNode node;
+    s = parser.next( node );
+    if( !s )
+    {
+        return TlvView();
+    }
+
+    TlvView view( node.tag, node.begin, node.end, data, depth - 1 );
+    if( view.expanded() )
+    {
+        ValidatingVisitor visitor;
+        s = Tlv::_walk( node.begin, node.end, data, depth - 1, visitor );
+        if( !s )
+        {
+            return TlvView();
+        }
+        s.set_parsed_len( node.encoded_end - data );
+    }
+    return view;
 }
 
-bool Tlv::boolean() const
+TlvView TlvView::parse_all( const uint8_t *data, const size_t size, Tlv::Status &s, int depth )
 {
-    return std::any_of( data_->value.begin(), data_->value.end(), [](uint8_t byte) {
-        return byte != 0x00;
-    } );
+    return Tlv::validate( data, size, s, depth ) ? TlvView( Tlv::Tag(), data, data + size, data, depth ) : TlvView();
 }
 
-int8_t Tlv::int8() const
+bool TlvView::empty() const
 {
-    return read_int_value_raw<int8_t>( data_->value );
+    return _tag.empty() && _begin == _end;
 }
 
-int16_t Tlv::int16() const
+bool TlvView::has_children() const
 {
-    return read_int_value_raw<int16_t>( data_->value );
+    return !children().empty();
 }
 
-int32_t Tlv::int32() const
+size_t TlvView::num_children() const
 {
-    return read_int_value_raw<int32_t>( data_->value );
+    auto range = children();
+    return std::distance( range.begin(), range.end() );
 }
 
-int64_t Tlv::int64() const
+Tlv::ByteSpan TlvView::value() const
 {
-    return read_int_value_raw<int64_t>( data_->value );
+    return expanded() ? Tlv::ByteSpan() : Tlv::ByteSpan( _begin, _end - _begin );
 }
 
-uint8_t Tlv::uint8() const
+TlvView::ChildRange TlvView::children() const
 {
-    return read_int_value_raw<uint8_t>( data_->value );
+    if( !expanded() )
+    {
+        return ChildRange( ChildIterator() );
+    }
+    else if( _tape )
+    {
+        // entries of the children follow the own entry, up to the end of the subtree
+        return _index == TlvTape::npos ? ChildRange( ChildIterator( _tape, 0, _tape->size() ) )
+                                       : ChildRange( ChildIterator( _tape, _index + 1, ( *_tape )[_index].end ) );
+    }
+    return ChildRange( ChildIterator( _begin, _end, _tree_begin, _depth - 1 ) );
 }
 
-uint16_t Tlv::uint16() const
+TlvView TlvView::find( const Tlv::Tag tag ) const
 {
-    return read_int_value_raw<uint16_t>( data_->value );
+    for( auto& child : children() )
+    {
+        if( child.tag() == tag )
+        {
+            return child;
+        }
+    }
+    return TlvView();
 }
 
-uint32_t Tlv::uint32() const
+Tlv TlvView::to_tlv( std::pmr::memory_resource *resource ) const
 {
-    return read_int_value_raw<uint32_t>( data_->value );
+    Tlv tlv = Tlv::_make( resource );
+    tlv.data_->tag = _tag;
+    if( expanded() )
+    {
+        if( _tape )
+        {
+            // nodes of the subtree are already indexed
+            _index == TlvTape::npos ? Tlv::_build( tlv, *_tape, 0, _tape->size() )
+                                    : Tlv::_build( tlv, *_tape, _index + 1, ( *_tape )[_index].end );
+        }
+        // structure was validated when the view was parsed
+        else if( _begin != _end )
+        {
+            Tlv::_parse( tlv, _begin, _end, _tree_begin, _depth );
+        }
+    }
+    else
+    {
+        tlv.data_->value.assign( _begin, _end );
+    }
+    return tlv;
 }
 
-uint64_t Tlv::uint64() const
-{
-    return read_int_value_raw<uint64_t>( data_->value );
-}
+TlvView::ChildIterator::ChildIterator() :
+    _next( nullptr ),
+    _end( nullptr ),
+    _tree_begin( nullptr ),
+    _depth( 0 ),
+    _tape( nullptr ),
+    _next_index( 0 ),
+    _end_index( 0 )
+{}
 
-const Tlv::ChildContainer& Tlv::children() const
+TlvView::ChildIterator::ChildIterator( const uint8_t* begin, const uint8_t* end, const uint8_t* tree_begin, int depth ) :
+    _next( begin ),
+    _end( end ),
+    _tree_begin( tree_begin ),
+    _depth( depth ),
+    _tape( nullptr ),
+    _next_index( 0 ),
+    _end_index( 0 )
 {
-    return data_->children;
+    operator++();
 }
 
-Tlv Tlv::front() const
+TlvView::ChildIterator::ChildIterator( const TlvTape* tape, uint32_t first, uint32_t last ) :
+    _next( nullptr ),
+    _end( nullptr ),
+    _tree_begin( nullptr ),
+    _depth( 0 ),
+    _tape( tape ),
+    _next_index( first ),
+    _end_index( last )
 {
-    return ( data_ && !data_->children.empty() ) ? Tlv( data_->children.front() ) : Tlv();
+    operator++();
 }
 
-Tlv Tlv::back() const
+TlvView::ChildIterator& TlvView::ChildIterator::operator++()
 {
-    return ( data_ && !data_->children.empty() ) ? Tlv( data_->children.back() ) : Tlv();
-}
+    if( _tape )
+    {
+        if( _next_index < _end_index )
+        {
+            _current = TlvView( _tape, _next_index );
+            _next = _current._end;
+            _next_index = ( *_tape )[_next_index].end;
+        }
+        else
+        {
+            *this = ChildIterator();
+        }
+        return *this;
+    }
 
-void Tlv::set_value( const Value& value )
-{
-    data_->value = value;
-    data_->children.clear();
+    Tlv::Parser parser( _next, _end, _tree_begin );
+    Tlv::Parser::ShallowNode node;
+    if( parser.has_next_tag() && parser.next( node ) )
+    {
+        _current = TlvView( node.tag, node.begin, node.end, _tree_begin, _depth );
+        _next = node.encoded_end;
+    }
+    else
+    {
+        // end of children, identical to default constructed end iterator
+        *this = ChildIterator();
+    }
+    return *this;
 }
-void Tlv::set_value( Value&& value )
+
+TlvView::ChildIterator TlvView::ChildIterator::operator++( int )
 {
-    data_->value = std::move(value);
-    data_->children.clear();
+    ChildIterator it( *this );
+    operator++();
+    return it;
 }
 
-void Tlv::set_tag( const Tag& tag )
+bool TlvView::ChildIterator::operator==( const ChildIterator& other ) const
 {
-    data_->tag = tag;
+    return _next == other._next && _current._begin == other._current._begin;
 }
 
-void Tlv::dfs( std::function<TraversalAction(Tlv&)> callback ) const
+/*
+ * TlvTape
+ */
+
+struct TlvTape::Builder
 {
-    if ( !callback )
+    TlvTape& tape;
+    InlineStack<uint32_t, 16> open;     // expanded entries of current branch
+
+    // projection state, ancestors of selected nodes are recorded tentatively and dropped if nothing was selected below
+    const Tlv::Projection* projection;
+    std::vector<uint32_t> branch;       // tags of expanded entries of current branch
+    int selected;                       // depth of the selected node of current branch, 0 if none
+
+    template< typename ShallowNode >
+    Tlv::TraversalAction enter( const ShallowNode& node, const uint8_t* header, int depth, bool expand )
     {
-        return;
-    }
+        if( projection && !( selected && depth > selected ) )
+        {
+            if( projection->selects( node.tag, branch ) )
+            {
+                selected = expand ? depth : 0;
+            }
+            // skip value or subtree without decoding it
+            else if( !expand || !projection->descends( node.tag, branch ) )
+            {
+                return Tlv::Prune;
+            }
+        }
 
-    std::vector<Tlv> stack;
-    stack.reserve( 4 );	 // start with a reasonable default size
-    stack.push_back( *this );
+        uint32_t index = tape._entries.size();
+        tape._entries.push_back( Entry{ node.tag, static_cast<uint32_t>( node.end - node.begin ), static_cast<uint32_t>( depth ), index + 1,
+                                        static_cast<size_t>( header - tape._data ), static_cast<size_t>( node.begin - tape._data ) } );
+        if( expand )
+        {
+            open.push_back( index );
+            if( projection )
+            {
+                branch.push_back( node.tag.value() );
+            }
+        }
+        return Tlv::Continue;
+    }
 
-    while( !stack.empty() )
+    void leave( Tlv::Tag, int depth )
     {
-        Tlv currentNode( std::move( stack.back() ) );
-        stack.pop_back();
+        uint32_t index = open.back();
+        open.pop_back();
 
-        // visit node
-        auto ret = callback( currentNode );
-        switch( ret )
+        if( projection )
         {
-            case Break: return;		// stop here
-            case Prune: continue;   // continue, but skip subtree of current node
-            case Continue: ;		// continue traversal
+            branch.pop_back();
+            if( selected == depth )
+            {
+                selected = 0;
+            }
+            else if( !selected && tape._entries.size() == index + 1 )
+            {
+                tape._entries.pop_back();
+                return;
+            }
         }
-        stack.insert( stack.end(), currentNode.data_->children.rbegin(), currentNode.data_->children.rend() );
+        tape._entries[index].end = tape._entries.size();
     }
+};
+
+TlvTape::TlvTape() :
+    _data( nullptr ),
+    _size( 0 ),
+    _depth( 0 )
+{}
+
+TlvTape TlvTape::index( const uint8_t *data, const size_t size, Tlv::Status &s, int depth )
+{
+    TlvTape tape;
+    s = tape._index( data, data + size, data, depth );
+    return tape;
 }
 
-void Tlv::dfs( std::function<TraversalAction(Tlv&, int depth)> callback ) const
+Tlv::Status TlvTape::_index( const uint8_t* begin, const uint8_t* end, const uint8_t* tree_begin, int maxDepth, const Tlv::Projection* projection )
 {
-    if ( !callback )
+    _entries.clear();
+    _data = tree_begin;
+    _size = end - tree_begin;
+    _depth = maxDepth;
+
+    // each node takes at least two bytes
+    if( static_cast<size_t>( end - begin ) / 2 >= npos )
     {
-        return;
+        return Tlv::Status( Tlv::Status::BadArgument, begin - tree_begin, "Input too large" );
     }
 
-    // track depth of node on stack
-    std::vector<std::pair<Tlv, int>> stack;
-    stack.reserve( 4 );	 // start with a reasonable default size
-    stack.emplace_back(std::make_pair(*this, 0));
-
-    while( !stack.empty() )
+    Builder builder{ *this, {}, projection, {}, 0 };
+    Tlv::Status status = Tlv::_walk( begin, end, tree_begin, maxDepth, builder );
+    if( !status )
     {
-        auto nodeElement( std::move( stack.back() ) );
-        stack.pop_back();
+        _entries.clear();
+    }
+    return status;
+}
 
-        // visit node
-        auto ret = callback( nodeElement.first, nodeElement.second );
-        switch( ret )
-        {
-            case Break: return;		// stop here
-            case Prune: continue;   // continue, but skip subtree of current node
-            case Continue: ;		// continue traversal
-        }
+bool TlvTape::expanded( uint32_t index ) const
+{
+    const Entry& entry = _entries[index];
+    return entry.tag.constructed() && entry.depth < static_cast<uint32_t>( _depth );
+}
 
-        auto& children = nodeElement.first.data_->children;
-        for( auto it = children.rbegin(); it != children.rend(); ++it )
-        {
-            stack.emplace_back(*it, nodeElement.second +1 );
-        }
-    }
+Tlv::ByteSpan TlvTape::value( uint32_t index ) const
+{
+    const Entry& entry = _entries[index];
+    return expanded( index ) ? Tlv::ByteSpan() : Tlv::ByteSpan( _data + entry.value_offset, entry.length );
 }
 
-void Tlv::bfs( std::function<TraversalAction(Tlv&)> callback ) const
+Tlv::ByteSpan TlvTape::encoded( uint32_t index ) const
 {
-    if ( !callback )
+    const Entry& entry = _entries[index];
+    // indefinite length nodes have a single length byte and end with end-of-contents
+    size_t size = entry.value_offset - entry.header_offset + entry.length;
+    if( entry.value_offset - entry.header_offset == entry.tag.size() + 1 && _data[entry.value_offset - 1] == 0x80 )
     {
-        return;
+        size += eoc_size;
     }
+    return Tlv::ByteSpan( _data + entry.header_offset, size );
+}
 
-    std::deque<Tlv> queue;
-    queue.push_back( *this );
-
-    while( !queue.empty() )
+uint32_t TlvTape::find( const Tlv::Tag tag, int maxDepth ) const
+{
+    // tape order is document order, subtrees at max depth are skipped by their end index
+    for( uint32_t i = 0; i < size() && maxDepth > 0; )
     {
-        Tlv currentNode( std::move( queue.front() ) );
-        queue.pop_front();
-
-        // visit node
-        auto ret = callback( currentNode );
-        switch( ret )
+        const Entry& entry = _entries[i];
+        if( entry.tag == tag )
         {
-            case Break: return;		// stop here
-            case Prune: continue;   // continue, but skip subtree of current node
-            case Continue: ;		// continue traversal
+            return i;
         }
-
-        // add children of current node to queue
-        queue.insert( queue.end(), currentNode.data_->children.begin(), currentNode.data_->children.end() );
+        i = entry.depth >= static_cast<uint32_t>( maxDepth ) ? entry.end : i + 1;
     }
+    return npos;
 }
 
-void Tlv::bfs( std::function<TraversalAction(Tlv&, int depth)> callback ) const
+std::vector<uint32_t> TlvTape::find_all( const Tlv::Tag tag, int maxDepth, bool findNested ) const
 {
-    if ( !callback )
+    std::vector<uint32_t> matches;
+    for( uint32_t i = 0; i < size() && maxDepth > 0; )
     {
-        return;
+        const Entry& entry = _entries[i];
+        bool match = entry.tag == tag;
+        if( match )
+        {
+            matches.push_back( i );
+        }
+        i = ( ( match && !findNested ) || entry.depth >= static_cast<uint32_t>( maxDepth ) ) ? entry.end : i + 1;
     }
+    return matches;
+}
 
-    // track depth of node in queue
-    std::deque<std::pair<Tlv, int>> queue;
-    queue.emplace_back(std::make_pair(*this, 0));
+TlvView TlvTape::view( uint32_t index ) const
+{
+    return TlvView( this, index );
+}
 
-    while( !queue.empty() )
-    {
-        auto nodeElement( std::move( queue.back() ) );
-        queue.pop_back();
+Tlv TlvTape::to_tlv( uint32_t index, std::pmr::memory_resource *resource ) const
+{
+    return view( index ).to_tlv( resource );
+}
 
-        // visit node
-        auto ret = callback( nodeElement.first, nodeElement.second );
-        switch( ret )
+/*
+ * FlatTlv
+ */
+
+struct FlatTlv::Builder
+{
+    FlatTlv& tree;
+    InlineStack<uint32_t, 16> open;     // expanded nodes of current branch
+
+    uint32_t add( Tlv::Tag tag, uint32_t parent, const uint8_t* begin, const uint8_t* end, bool leaf )
+    {
+        uint32_t index = tree._tags.size();
+        tree._tags.push_back( tag.value() );
+        tree._parents.push_back( parent );
+        tree._ends.push_back( index + 1 );
+        tree._value_offsets.push_back( tree._values.size() );
+        if( leaf )
         {
-            case Break: return;		// stop here
-            case Prune: continue;   // continue, but skip subtree of current node
-            case Continue: ;		// continue traversal
+            tree._value_lengths.push_back( end - begin );
+            tree._values.insert( tree._values.end(), begin, end );
         }
-
-        auto& children = nodeElement.first.data_->children;
-        for( auto it = children.rbegin(); it != children.rend(); ++it )
+        else
         {
-            queue.emplace_back(*it, nodeElement.second +1 );
+            tree._value_lengths.push_back( 0 );
         }
+        return index;
     }
-}
 
-Tlv Tlv::find( const Tag tag, int maxDepth ) const
-{
-    // just iterate to find direct childen
-    if( maxDepth == DirectChildren )
+    template< typename ShallowNode >
+    Tlv::TraversalAction enter( const ShallowNode& node, const uint8_t*, int, bool expand )
     {
-        for( auto& child : data_->children )
+        uint32_t index = add( node.tag, open.back(), node.begin, node.end, !expand );
+        if( expand )
         {
-            if( child.tag() == tag )
-            {
-                return child;
-            }
+            open.push_back( index );
         }
-
-        return Tlv();
+        return Tlv::Continue;
     }
-    // dfs search to find first deep match
-    else
+
+    void leave( Tlv::Tag, int )
     {
-        Tlv tlv;
-        auto find_tag = [&]( const Tlv& child, int depth )
-        {
-            if( child.tag() == tag )
-            {
-                tlv = child;
-                return TraversalAction::Break;
-            }
-            else if( depth == maxDepth )
-            {
-                return TraversalAction::Prune;
-            }
-            else
-            {
-                return TraversalAction::Continue;
-            }
-        };
+        tree._ends[open.back()] = tree._tags.size();
+        open.pop_back();
+    }
 
-        _dfs_unsafe_depth( find_tag );
-        return tlv;
+    void finish()
+    {
+        // close root node
+        tree._ends[0] = tree._tags.size();
     }
-}
+};
 
-std::vector<Tlv> Tlv::find_all( const Tag tag, int maxDepth, bool findNested ) const
-{
-    std::vector<Tlv> matches;
+FlatTlv::FlatTlv()
+{}
 
-    // just iterate to find direct childen
-    if( maxDepth == DirectChildren )
+FlatTlv FlatTlv::parse( const uint8_t *data, const size_t size, Tlv::Status &s, int depth )
+{
+    FlatTlv tree;
+    if( depth <= 0 || size >= npos )
     {
-        for( auto& child : data_->children )
-        {
-            if( child.tag() == tag )
-            {
-                matches.push_back( child );
-            }
-        }
+        s = Tlv::Status( Tlv::Status::BadArgument, 0, depth <= 0 ? "Minimum parse depth is 1" : "Input too large" );
+        return tree;
     }
-    // dfs search to find deep matches
-    else
+
+    s = Tlv::Status();
+    Builder builder{ tree, {} };
+    Tlv::Parser parser( data, data + size, data );
+    if( !parser.has_next_tag() )
     {
-        auto find_tag = [&]( const Tlv& child, int depth )
-        {
-            bool match = child.tag() == tag;
-            if( match )
-            {
-                matches.push_back( child );
-            }
+        builder.add( Tlv::Tag(), npos, data, data, false );
+        return tree;
+    }
 
-            if( ( match && !findNested ) || depth == maxDepth )
-            {
-                return TraversalAction::Prune;
-            }
-            else
-            {
-                return TraversalAction::Continue;
-            }
-        };
+    Tlv::Parser::ShallowNode node;
+    s = parser.next( node );
+    if( !s )
+    {
+        return FlatTlv();
+    }
 
-        _dfs_unsafe_depth( find_tag );
+    bool expand = node.tag.constructed() && depth > 1;
+    builder.open.push_back( builder.add( node.tag, npos, node.begin, node.end, !expand ) );
+    if( expand )
+    {
+        Tlv::Status status = Tlv::_walk( node.begin, node.end, data, depth - 1, builder );
+        if( !status )
+        {
+            s = status;
+            return FlatTlv();
+        }
     }
-    return matches;
+    builder.finish();
+    return tree;
 }
 
-size_t Tlv::remove( const Tag tag )
+FlatTlv FlatTlv::parse_all( const uint8_t *data, const size_t size, Tlv::Status &s, int depth )
 {
-    size_t num = 0;
-    for( auto it = data_->children.begin(); it != data_->children.end(); ++it )
+    FlatTlv tree;
+    if( size >= npos )
     {
-        if ( it->tag() == tag )
-        {
-            it->data_->parent = nullptr;
-            it = it->data_->children.erase( it );
-            num++;
-        }
+        s = Tlv::Status( Tlv::Status::BadArgument, 0, "Input too large" );
+        return tree;
     }
-    return num;
+
+    Builder builder{ tree, {} };
+    builder.open.push_back( builder.add( Tlv::Tag(), npos, data, data, false ) );
+    s = Tlv::_walk( data, data + size, data, depth, builder );
+    if( !s )
+    {
+        return FlatTlv();
+    }
+    builder.finish();
+    return tree;
+}
+
+FlatTlv::Node FlatTlv::root() const
+{
+    return empty() ? Node() : Node( this, 0 );
 }
 
-// Modifiers
+FlatTlv::Node FlatTlv::at( uint32_t index ) const
+{
+    return index < size() ? Node( this, index ) : Node();
+}
 
-void Tlv::set_parent( Tlv &parent )
+FlatTlv::Node FlatTlv::find( const Tlv::Tag tag, int maxDepth ) const
 {
-    parent.push_back( *this );
+    return empty() ? Node() : root().find( tag, maxDepth );
 }
 
-void Tlv::push_front( Tlv &child )
+std::vector<FlatTlv::Node> FlatTlv::find_all( const Tlv::Tag tag, int maxDepth, bool findNested ) const
 {
-    data_->value.clear();
-    child.detach();
-    child.data_->parent = data_.get();
-    data_->children.insert( data_->children.begin(), child );
+    return empty() ? std::vector<Node>() : root().find_all( tag, maxDepth, findNested );
 }
 
-void Tlv::push_front( Tlv&& child )
+void FlatTlv::dfs( std::function<Tlv::TraversalAction(const Node&)> callback ) const
 {
-    data_->value.clear();
-    child.detach();
-    child.data_->parent = data_.get();
-    data_->children.insert( data_->children.begin(), std::move( child ) );
+    if( !empty() )
+        root().dfs( callback );
 }
 
-void Tlv::push_back( Tlv& child )
+void FlatTlv::dfs( std::function<Tlv::TraversalAction(const Node&, int depth)> callback ) const
 {
-    data_->value.clear();
-    child.detach();
-    child.data_->parent = data_.get();
-    data_->children.push_back( child );
+    if( !empty() )
+        root().dfs( callback );
 }
 
-void Tlv::push_back( Tlv&& child )
+std::vector<uint8_t> FlatTlv::dump() const
 {
-    data_->value.clear();
-    child.detach();
-    child.data_->parent = data_.get();
-    data_->children.push_back( std::move( child) );
+    return empty() ? std::vector<uint8_t>() : root().dump();
 }
 
-void Tlv::pop_front()
+Tlv FlatTlv::to_tlv() const
 {
-    if ( !data_->children.empty() )
-    {
-        assert( data_->children.front().data_->parent == data_.get() );
-        // unset parent and remove from children
-        data_->children.front().data_->parent = nullptr;
-        data_->children.erase( data_->children.begin() );
-    }
+    return empty() ? Tlv() : root().to_tlv();
 }
 
-void Tlv::pop_back()
+Tlv::ByteSpan FlatTlv::Node::value() const
 {
-    if ( !data_->children.empty() )
-    {
-        assert( data_->children.back().data_->parent == data_.get() );
-        // unset parent and remove from children
-        data_->children.back().data_->parent = nullptr;
-        data_->children.pop_back();
-    }
+    return Tlv::ByteSpan( _tree->_values.data() + _tree->_value_offsets[_index], _tree->_value_lengths[_index] );
 }
 
-void Tlv::detach()
+FlatTlv::Node FlatTlv::Node::parent() const
 {
-    if ( data_->parent )
-    {
-        for( auto it = data_->parent->children.begin(); it != data_->parent->children.end(); ++it )
-        {
-            if ( it->data_.get() == data_.get() )
-            {
-                data_->parent->children.erase( it );
-                data_->parent = nullptr;
-                return;
-            }
-        }
-        /* Unreachable, because if this node has a parent, it must be child of it's parent. */
-        assert( false );
-    }
+    return has_parent() ? Node( _tree, _tree->_parents[_index] ) : Node();
 }
 
-void Tlv::erase( const Tag tag )
+size_t FlatTlv::Node::num_children() const
 {
-    for( auto it = data_->children.begin(); it != data_->children.end(); ++it )
+    size_t num = 0;
+    for( uint32_t child = _index + 1; child < _tree->_ends[_index]; child = _tree->_ends[child] )
     {
-        if ( it->data_->tag == tag )
-        {
-            it = it->data_->children.erase( it );
-        }
+        num++;
     }
+    return num;
 }
 
-void Tlv::swap( Tlv &other )
+FlatTlv::Node FlatTlv::Node::first_child() const
 {
-    std::shared_ptr<Data> tmp = data_;
-    data_ = other.data_;
-    other.data_ = tmp;
+    return has_children() ? Node( _tree, _index + 1 ) : Node();
 }
 
-void Tlv::reset()
+FlatTlv::Node FlatTlv::Node::next_sibling() const
 {
-    data_ = std::make_shared<Data>();
+    // the next sibling starts after the own subtree, unless the subtree of the parent ends there
+    uint32_t next = _tree->_ends[_index];
+    return has_parent() && next < _tree->_ends[_tree->_parents[_index]] ? Node( _tree, next ) : Node();
 }
 
-template< typename T >
-inline void Tlv::_dfs_unsafe( T callback ) const
+FlatTlv::Node FlatTlv::Node::find( const Tlv::Tag tag, int maxDepth ) const
 {
-    std::vector<const Tlv*> stack;
-    stack.reserve( 4 );				// start with a reasonable default size
-    stack.push_back( this );
+    const auto& tags = _tree->_tags;
+    const auto& ends = _tree->_ends;
 
-    while( !stack.empty() )
+    // iterate siblings to find direct children
+    if( maxDepth == Tlv::DirectChildren )
     {
-        const Tlv* currentNode = stack.back();
-        stack.pop_back();
-
-        auto ret = callback( *currentNode );
-
-        switch( ret )
-        {
-            case Break: return;		// stop here
-            case Prune: continue;   // continue, but skip subtree of current node
-            case Continue: ;		// continue traversal
-        }
-
-        // add children of current node to stack - first child must be on top of stack
-        auto &children = currentNode->data_->children;
-        for( int r = children.size() - 1; r >= 0; r-- )
+        for( uint32_t child = _index + 1; child < ends[_index]; child = ends[child] )
         {
-            stack.push_back(&children[r]);
+            if( tags[child] == tag.value() )
+            {
+                return Node( _tree, child );
+            }
         }
     }
-}
-
-template< typename T >
-inline void Tlv::_dfs_unsafe_depth( T callback ) const
-{
-    std::vector<std::pair<const Tlv*, int>> stack;
-    stack.reserve( 4 );				// start with a reasonable default size
-    stack.emplace_back( this, 0 );
-
-    while( !stack.empty() )
+    // pre-order matches document order, unlimited searches are a linear scan over all tags of the subtree
+    else if( maxDepth == Tlv::Deep )
     {
-        auto currentElement = stack.back();
-        stack.pop_back();
-
-        auto ret = callback( *(currentElement.first), currentElement.second );
-
-        switch( ret )
+        auto it = std::find( tags.begin() + _index, tags.begin() + ends[_index], tag.value() );
+        if( it != tags.begin() + ends[_index] )
         {
-            case Break: return;		// stop here
-            case Prune: continue;   // continue, but skip subtree of current node
-            case Continue: ;		// continue traversal
+            return Node( _tree, it - tags.begin() );
         }
-
-        // add children of current node to stack - first child must be on top of stack
-        auto &children = currentElement.first->data_->children;
-        for( int r = children.size() - 1; r >= 0; r-- )
+    }
+    else
+    {
+        Node match;
+        dfs( [&]( const Node& node, int depth )
         {
-            stack.emplace_back(&children[r], currentElement.second + 1);
-        }
+            if( node.tag() == tag )
+            {
+                match = node;
+                return Tlv::Break;
+            }
+            return depth == maxDepth ? Tlv::Prune : Tlv::Continue;
+        } );
+        return match;
     }
+    return Node();
 }
 
-const Tlv::Status Tlv::_parse(Tlv& root, const uint8_t* begin, const uint8_t* end, const uint8_t* tree_begin, int maxDepth)
+std::vector<FlatTlv::Node> FlatTlv::Node::find_all( const Tlv::Tag tag, int maxDepth, bool findNested ) const
 {
-    if( maxDepth <= 0 )
-    {
-        return Status( Status::BadArgument, begin - tree_begin, "Minimum parse depth is 1" );
-    }
-
-    struct BacklogNode			// for incomplete nodes in backlog
-    {
-        Data* data;
-        const uint8_t* begin;
-        const uint8_t* end;
-        int depth;
-    };
+    const auto& tags = _tree->_tags;
+    const auto& ends = _tree->_ends;
+    std::vector<Node> matches;
 
-    Status status;
-    std::vector<BacklogNode> backlogStack;
-    backlogStack.reserve(4); // start with reasonable default size
-    std::vector<Parser::ShallowNode> nodeCache;
-    nodeCache.reserve(4);    // start with a reasonable default size
-
-    backlogStack.push_back( BacklogNode{ root.data_.get(), begin, end, 0 } );
-
-    while( !backlogStack.empty() )
+    // iterate siblings to find direct children
+    if( maxDepth == Tlv::DirectChildren )
     {
-        BacklogNode curNode = backlogStack.back();
-        backlogStack.pop_back();
-        int curChildDepth = curNode.depth + 1;
-
-        Parser parser(curNode.begin, curNode.end, tree_begin);
-        nodeCache.clear();
-
-        while( parser.has_next_tag() )
+        for( uint32_t child = _index + 1; child < ends[_index]; child = ends[child] )
         {
-            nodeCache.emplace_back();
-            status = parser.next( nodeCache.back() );
-
-            // Abort on parse errors
-            if( !status )
+            if( tags[child] == tag.value() )
             {
-                return status;
+                matches.push_back( Node( _tree, child ) );
             }
         }
-
-        curNode.data->children.reserve( nodeCache.size() );
-        for( auto &cacheNode : nodeCache )
+    }
+    // linear scan, subtrees of matches are skipped by jumping to their end
+    else if( maxDepth == Tlv::Deep )
+    {
+        for( uint32_t i = _index; i < ends[_index]; )
         {
-            curNode.data->children.push_back( Tlv() );
-            Data* childDataPtr = curNode.data->children.back().data_.get();
-            childDataPtr->tag = cacheNode.tag;
-            childDataPtr->parent = curNode.data;
-
-            // Constructed nodes must be revisted for parsing of child nodes, unless max depth was reached
-            if ( cacheNode.tag.constructed() && curChildDepth < maxDepth )
+            if( tags[i] == tag.value() )
             {
-                backlogStack.push_back( BacklogNode{childDataPtr, cacheNode.begin, cacheNode.end, curChildDepth} );
+                matches.push_back( Node( _tree, i ) );
+                i = findNested ? i + 1 : ends[i];
             }
-            // Otherwise assign data
             else
             {
-                childDataPtr->value.assign(cacheNode.begin, cacheNode.end);
+                i++;
             }
         }
     }
-
-    // The rightmost node, might not be the last that is parsed. Set propper end posistion here.
-    status.set_parsed_len( end - tree_begin );
-    return status;
-}
-
-const Tlv::Status Tlv::_parse_one(Tlv& root, const uint8_t* begin, const uint8_t* end, const uint8_t* tree_begin, int maxDepth)
-{
-    if( maxDepth <= 0 )
-    {
-        return Status( Status::BadArgument, begin - tree_begin, "Minimum parse depth is 1" );
-    }
-
-    Status s;
-    Parser parser(begin, end, tree_begin);
-    if( parser.has_next_tag() )
+    else
     {
-        Parser::ShallowNode shallowNode;
-        s = parser.next( shallowNode );
-
-        if( s )
+        dfs( [&]( const Node& node, int depth )
         {
-            root.data_->tag = shallowNode.tag;
-            // Do we neet to continue parsing children?
-            if( root.tag().constructed() && maxDepth -1 > 0 )
-            {
-                s = _parse( root, shallowNode.begin, shallowNode.end, tree_begin, maxDepth -1 );
-            }
-            else
+            bool match = node.tag() == tag;
+            if( match )
             {
-                root.data_->value.assign( shallowNode.begin, shallowNode.end );
+                matches.push_back( node );
             }
-
-        }
+            return ( ( match && !findNested ) || depth == maxDepth ) ? Tlv::Prune : Tlv::Continue;
+        } );
     }
-
-    return s;
+    return matches;
 }
 
-const Tlv::Status Tlv::_parse_formatted(Tlv &root, std::string_view data)
+void FlatTlv::Node::dfs( std::function<Tlv::TraversalAction(const Node&)> callback ) const
 {
-    /* Note: The formatted parser parses tags linewise, indentation defines nesting.
-     * Tags in the data-format appear in DFS order of the TLV-tree */
-    FormattedParser parser( data );
-    Tlv::Status status;
+    if( !callback )
+    {
+        return;
+    }
+    dfs( [&]( const Node& node, int ) { return callback( node ); } );
+}
 
-    struct ParentNode
+void FlatTlv::Node::dfs( std::function<Tlv::TraversalAction(const Node&, int depth)> callback ) const
+{
+    if( !callback )
     {
-        Data* node;
-        int   child_indent;   // indentation child tags
-    };
+        return;
+    }
 
-    // The stack has the parent nodes chain
-    std::vector<ParentNode> stack;
-    stack.reserve( 4 );
-    // Virtual root node without tag number has all children (per definition they have indent >= 0)
-    stack.push_back({ root.data_.get(), -1 });
+    // subtree ends of the current branch, its size is the depth of the current node
+    InlineStack<uint32_t, 16> branch;
+    const auto& ends = _tree->_ends;
 
-    while( parser.has_next_tag() )
+    for( uint32_t i = _index; i < ends[_index]; )
     {
-        // Parse one line / tag
-        FormattedParser::ShallowNode node;
-        status = parser.next( node );
-        if( !status.ok() )
+        while( !branch.empty() && i >= branch.back() )
         {
-            return status;
+            branch.pop_back();
         }
 
-        // Create Tlv node for decoded ShallowNode
-        Tlv tlvNode( node.tag );
-        if( !node.hexData.empty() )
+        switch( callback( Node( _tree, i ), branch.size() ) )
         {
-            tlvNode.set_value( LibtlvUtil::unhexify( node.hexData ));
+            case Tlv::Break: return;                // stop here
+            case Tlv::Prune: i = ends[i]; continue;   // continue, but skip subtree of current node
+            case Tlv::Continue: ;                   // continue traversal
         }
 
-        /* Assertion due to DFS-order:
-         * Each node that has child nodes, has at least one direct child tag that comes immediately after.
-         * If a non direct child requires stack-unwind, it must already have other child nodes with
-         * equal indentation */
-
-        // Case 1: Child of current parent on stack
-        if( node.indent >= stack.back().child_indent )
+        if( ends[i] > i + 1 )
         {
-            // Sibling of last tag
-            if( stack.back().child_indent == node.indent )
-            {
-                stack.back().node->children.push_back( tlvNode );
-            }
-            // First child of root node (special case)
-            else if( stack.back().child_indent == -1 )
-            {
-                stack.back().child_indent = node.indent;
-                stack.back().node->children.push_back( tlvNode );
-            }
-            // Subtag of last tag,
-            else if ( node.indent > stack.back().child_indent )
-            {
-                // The last child tag of the current parent, becomes new parent for this tag
-                auto new_parent = stack.back().node->children.back().data_.get();
+            branch.push_back( ends[i] );
+        }
+        i++;
+    }
+}
 
-                // Enforce that parent is a constructred tag
-                if( !new_parent->tag.constructed() )
-                {
-                    status = Tlv::Status( Tlv::Status::UnexpectedData, parser.get_cur_pos(),
-                                          "Invalid subtag %X for non-construted parent tag %X on line %u",
-                                          node.tag.value(), new_parent->tag.value(), (unsigned)parser.get_cur_line()-1 );
-                    return status;
-                }
-                // Enforce that parent has no payload data
-                if( !new_parent->value.empty() )
-                {
-                    status = Tlv::Status( Tlv::Status::UnexpectedData, parser.get_cur_pos(),
-                                          "Invalid subtag %X for parent tag %X with payload data on line %u",
-                                          node.tag.value(), new_parent->tag.value(), (unsigned)parser.get_cur_line()-1 );
-                    return status;
-                }
+std::vector<uint8_t> FlatTlv::Node::dump() const
+{
+    const auto& tags = _tree->_tags;
+    const auto& parents = _tree->_parents;
+    uint32_t end = _tree->_ends[_index];
 
-                // It must be pushed on stack
-                stack.push_back( { new_parent, node.indent } );
-                // This node with bigger indentation becomes first child of new parent
-                stack.back().node->children.push_back( tlvNode );
-            }
+    // payload sizes, children come after their parent in pre-order and are summed up in reverse order
+    std::vector<size_t> sizes( end - _index, 0 );
+    for( uint32_t i = end; i-- > _index; )
+    {
+        size_t& size = sizes[i - _index];
+        size += _tree->_value_lengths[i];
+        if( i > _index )
+        {
+            Tlv::Tag tag( tags[i] );
+            sizes[parents[i] - _index] += size + ( tag.empty() ? 0 : tag.size() + len_field_size( size ) );
         }
+    }
 
-        // Case 2: Sibling of a previous tag on stack
-        else
-        {
-            // Unwind stack until finding the correct parent
-            // Note that the root note will never be removed since it's child_indent (-1) is smaller than for any other node
-            while( stack.back().child_indent > node.indent )
-            {
-                stack.pop_back();
-            }
+    std::vector<uint8_t> output;
+    output.reserve( Tlv::Tag( tags[_index] ).size() + len_field_size( sizes[0] ) + sizes[0] );
+    for( uint32_t i = _index; i < end; i++ )
+    {
+        auto value = Node( _tree, i ).value();
+        build_header( output, tags[i], sizes[i - _index] );
+        output.insert( output.end(), value.begin(), value.end() );
+    }
+    return output;
+}
 
-            // Enforce that all children of a tag use identical indentation
-            if( stack.back().child_indent != node.indent )
-            {
-                status = Tlv::Status( Tlv::Status::UnexpectedData, parser.get_cur_pos(),
-                                      "Tag %X on line %u has unexpected indentation.", node.tag.value(), (unsigned)parser.get_cur_line()-1 );
-                return status;
-            }
+Tlv FlatTlv::Node::to_tlv() const
+{
+    uint32_t end = _tree->_ends[_index];
+    std::vector<Tlv> nodes;
+    nodes.reserve( end - _index );
 
-            // Set as child of current parent
-            stack.back().node->children.push_back( tlvNode );
+    for( uint32_t i = _index; i < end; i++ )
+    {
+        auto value = Node( _tree, i ).value();
+        nodes.emplace_back( Tlv::Tag( _tree->_tags[i] ) );
+        nodes.back().data_->value.assign( value.begin(), value.end() );
+        if( i > _index )
+        {
+            nodes[_tree->_parents[i] - _index].push_back( nodes.back() );
         }
     }
-
-    status.set_parsed_len(parser.get_cur_pos());
-    return status;
+    return nodes.front();
 }